@@ -0,0 +1,139 @@
+//
+// Lossless codec benchmark
+//
+// Encode test signals shaped like the SPI input (12 bit << 4), check
+// that the decoded stream is identical, report encode/decode speed and
+// compression ratio against 16 bit PCM. The near zero and alternating
+// signals are there for the order 0 predictor, it never wins on a sine.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "xample.h"
+
+#define NSTEPS   (1024*1024)
+#define NROUNDS  5
+
+#define SIG_SINE  0   // slow sine around mid scale
+#define SIG_ZERO  1   // noise just above zero
+#define SIG_ALT   2   // alternating 0/1000 (raw, not 12 bit shifted)
+
+static char* sig_name[] = { "sine", "zero", "alt" };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// signal per channel plus noise, 12 bit samples scaled to 16 bit
+static void gen_samples(sample_t* vec, size_t nchan, size_t nsteps,
+			int sig, int noise)
+{
+    size_t i, c;
+
+    for (i = 0; i < nsteps; i++) {
+	for (c = 0; c < nchan; c++) {
+	    double s = sin(2*M_PI*i/(2000.0*(c+1)));
+	    long v = (rand() % (2*noise+1)) - noise;
+	    if (sig == SIG_ALT) {
+		vec[i*nchan+c] = ((i + c) & 1) ? 1000 : 0;
+		continue;
+	    }
+	    v += (sig == SIG_ZERO) ? noise : 2048 + 1500*s;
+	    if (v < 0) v = 0;
+	    if (v > 4095) v = 4095;
+	    vec[i*nchan+c] = v << 4;
+	}
+    }
+}
+
+static uint8_t* read_file(int fd, size_t* len)
+{
+    off_t end = lseek(fd, 0, SEEK_END);
+    uint8_t* buf = malloc(end);
+
+    if (pread(fd, buf, end, 0) != end)
+	exit(1);
+    *len = end;
+    return buf;
+}
+
+static int run(size_t nchan, int sig, int noise)
+{
+    size_t n = NSTEPS*nchan;
+    sample_t* vec = malloc(n*sizeof(sample_t));
+    sample_t* out = malloc((n + XAMPLE_BLOCK_STEPS*nchan)*sizeof(sample_t));
+    FILE* f = tmpfile();
+    int fd = fileno(f);
+    double t0, tenc = 0, tdec = 0;
+    uint8_t* buf = NULL;
+    size_t len = 0, pos, m = 0, bsteps;
+    uint32_t rate;
+    int i;
+
+    gen_samples(vec, nchan, NSTEPS, sig, noise);
+    for (i = 0; i < NROUNDS; i++) {
+	xample_enc_t* enc;
+	size_t k;
+	t0 = now();
+	enc = xample_enc_open(fd, 0, nchan, 50000 << 8, XAMPLE_BLOCK_STEPS);
+	for (k = 0; k < n; k += 10000*nchan)
+	    xample_enc_write(enc, vec+k, (n-k < 10000*nchan) ? n-k : 10000*nchan);
+	xample_enc_close(enc);
+	tenc += now() - t0;
+    }
+    free(buf);
+    buf = read_file(fd, &len);
+
+    for (i = 0; i < NROUNDS; i++) {
+	t0 = now();
+	pos = xample_dec_header(buf, len, &nchan, &rate, &bsteps);
+	m = 0;
+	while(pos < len) {
+	    uint64_t first;
+	    size_t steps;
+	    ssize_t size = xample_dec_block_info(buf+pos, len-pos, &first, &steps);
+	    if ((size < 0) || (first != m) ||
+		(xample_dec_block(buf+pos, len-pos, nchan, bsteps, out+m) < 0)) {
+		fprintf(stderr, "decode error at %zu\n", pos);
+		return -1;
+	    }
+	    m += steps*nchan;
+	    pos += size;
+	}
+	tdec += now() - t0;
+    }
+    if ((m != n) || (memcmp(vec, out, n*sizeof(sample_t)) != 0)) {
+	fprintf(stderr, "round trip mismatch nchan=%zu %s noise=%d\n", nchan,
+		sig_name[sig], noise);
+	return -1;
+    }
+    printf("nchan=%zu %-4s noise=%-3d ratio %5.2f  encode %7.1f Msamples/s "
+	   " decode %7.1f Msamples/s\n", nchan, sig_name[sig], noise,
+	   (double)(n*sizeof(sample_t))/len,
+	   (double)n*NROUNDS/tenc/1e6, (double)n*NROUNDS/tdec/1e6);
+    fclose(f);
+    free(buf);
+    free(vec);
+    free(out);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+    if ((run(1, SIG_SINE, 2) < 0) || (run(1, SIG_SINE, 20) < 0) ||
+	(run(4, SIG_SINE, 2) < 0) || (run(4, SIG_SINE, 200) < 0) ||
+	(run(8, SIG_SINE, 0) < 0) ||
+	(run(1, SIG_ZERO, 3) < 0) || (run(4, SIG_ZERO, 20) < 0) ||
+	(run(1, SIG_ALT, 0) < 0) || (run(2, SIG_ALT, 0) < 0))
+	exit(1);
+    return 0;
+}
@@ -0,0 +1,183 @@
+//
+// Sample ring mapping benchmark
+//
+// Create a ring with 4K pages, prefaulted, and huge pages, then time
+// the producer first pass over the ring, a reader open plus full scan
+// and random reads over the ring. Page faults are counted with
+// getrusage, dTLB read misses with perf_event_open when available.
+//
+// usage: map_bench [-m <MiB>] [<hugetlbfs-dir>]
+//
+// Without a hugetlbfs directory the huge page runs use a plain shm name,
+// that is XAMPLE_HUGETLBFS when mounted, else transparent huge pages
+// (when /sys/kernel/mm/transparent_hugepage/shmem_enabled allows).
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "xample.h"
+
+#define NRANDOM  (8*1024*1024)
+#define NAME     "/xample_map_bench"
+
+typedef struct {
+    double t;
+    long   minflt;
+    long   tlb;    // -1 when not available
+} mark_t;
+
+static int tlb_fd = -1;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void tlb_open(void)
+{
+#if defined(__linux__)
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HW_CACHE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_DTLB |
+	(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    tlb_fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+#endif
+}
+
+static void mark(mark_t* m)
+{
+    struct rusage ru;
+    uint64_t count;
+
+    getrusage(RUSAGE_SELF, &ru);
+    m->minflt = ru.ru_minflt;
+    m->tlb = -1;
+    if ((tlb_fd >= 0) && (read(tlb_fd, &count, sizeof(count)) == sizeof(count)))
+	m->tlb = count;
+    m->t = now();
+}
+
+static void report(char* what, mark_t* m0, mark_t* m1, size_t n)
+{
+    printf("  %-12s %9.2f ms %9ld faults", what, (m1->t - m0->t)*1e3,
+	   m1->minflt - m0->minflt);
+    if (m0->tlb >= 0)
+	printf(" %11ld dtlb-miss", m1->tlb - m0->tlb);
+    else
+	printf("           - dtlb-miss");
+    if (n > 0)
+	printf(" %7.2f ns/access", (m1->t - m0->t)*1e9/n);
+    printf("\n");
+}
+
+static void run(char* name, char* label, int flags, size_t nsamples)
+{
+    sample_t* data;
+    sample_t* rdata;
+    xample_t* xp;
+    xample_t* rp;
+    mark_t m0, m1;
+    uint64_t sum = 0, x = 1;
+    size_t i, n;
+
+    mark(&m0);
+    if ((xp = xample_create(name, nsamples, 2, 1, XAMPLE_FMT_U16, 50000.0,
+			    0600, flags, &data)) == NULL) {
+	printf("%s: not available\n", label);
+	return;
+    }
+    mark(&m1);
+    n = xp->ring_samples;
+    printf("%s: %lu MiB, huge page %lu KiB\n", label, xp->map_size >> 20,
+	   xp->huge_page_size >> 10);
+    report("create", &m0, &m1, 0);
+
+    // producer first pass over the ring
+    mark(&m0);
+    for (i = 0; i < n; i++)
+	data[i] = i;
+    xample_publish(xp, n);
+    mark(&m1);
+    report("write", &m0, &m1, 0);
+
+    // reader open and scan
+    mark(&m0);
+    if ((rp = xample_open(name, 0, &rdata)) == NULL)
+	exit(1);
+    for (i = 0; i < n; i++)
+	sum += rdata[i];
+    mark(&m1);
+    report("open+scan", &m0, &m1, 0);
+
+    // random reads, one per cache line (TLB bound)
+    mark(&m0);
+    for (i = 0; i < NRANDOM; i++) {
+	x = x*6364136223846793005ULL + 1442695040888963407ULL;
+	sum += rdata[(x >> 33) % n];
+    }
+    mark(&m1);
+    report("random", &m0, &m1, NRANDOM);
+
+    if (sum == 42)  // keep the loops
+	printf("\n");
+    xample_close(rp);
+    xample_close(xp);
+}
+
+int main(int argc, char** argv)
+{
+    char* name = NAME;
+    char path[FILENAME_MAX];
+    char* huge_name = name;
+    size_t mib = 64;
+    size_t nsamples;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+	switch(opt) {
+	case 'm':
+	    mib = atoi(optarg);
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-m <MiB>] [<hugetlbfs-dir>]\n",
+		    argv[0]);
+	    exit(1);
+	}
+    }
+    if (optind < argc) {
+	snprintf(path, sizeof(path), "%s%s", argv[optind], name);
+	huge_name = path;
+    }
+    nsamples = (mib << 20) / sizeof(sample_t);
+    tlb_open();
+
+    run(name, "shm 4k", 0, nsamples);
+    run(name, "shm 4k prefault", XAMPLE_MAP_POPULATE, nsamples);
+    run(huge_name, "huge", XAMPLE_MAP_HUGE, nsamples);
+    run(huge_name, "huge prefault", XAMPLE_MAP_HUGE|XAMPLE_MAP_POPULATE,
+	nsamples);
+    shm_unlink(name);
+    unlink(XAMPLE_HUGETLBFS NAME);
+    if (huge_name != name)
+	unlink(huge_name);
+    return 0;
+}
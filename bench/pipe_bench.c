@@ -0,0 +1,390 @@
+//
+// End to end pipeline benchmark
+//
+// Producer (simulator, paced per frame) -> shared memory ring -> reader
+// processes, for each channel count at increasing rates. The readers
+// follow the write sequence the way the logger does (xample_wait, read
+// everything new, unpack) and record:
+//   latency  publish (frame time table stamp) to reader wakeup
+//   lag      samples the write sequence is ahead of the reader cursor
+//            when the reader has read what it woke up for (0 while it
+//            keeps up, the new data at wakeup is always about a frame)
+//   dropped  samples overwritten before they were read
+// A run is ok when the producer reach 99% of the rate without schedule
+// restarts and no reader dropped data. The rates stop at the first run
+// that is not ok, the last ok rate is the max sustainable rate.
+// CPU per MS/s is producer plus readers cpu time per second, per
+// million samples per second (1.0 = one core at 1 MS/s).
+//
+// usage: pipe_bench [-j] [-r <readers>] [-c <chan>,..] [-f <hz>,..]
+//                   [-d <secs>] [-x <format>]
+//
+// -j writes one JSON object per run and one per channel count summary
+// (JSON lines), otherwise a table.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "xample.h"
+
+#define NAME         "/xample_pipe_bench"
+#define MAX_READERS  8
+#define MAX_LATENCY  (1 << 17)  // latency records per reader
+#define RING_SECS    0.5        // ring length in time
+#define READ_BLOCK   4096       // samples per unpack
+
+typedef struct {
+    uint64_t wakeups;
+    uint64_t samples;
+    uint64_t dropped;      // samples
+    uint64_t lag_max;      // samples
+    double   lag_sum;
+    size_t   nlat;
+    uint32_t lat[MAX_LATENCY];  // ns, saturated
+} reader_stat_t;
+
+typedef struct {
+    volatile int stop;
+    reader_stat_t r[MAX_READERS];
+} shared_t;
+
+typedef struct {
+    size_t   nchan;
+    double   rate;         // per channel
+    double   achieved;     // samples/s all channels
+    double   cpu;          // cpu seconds per second, producer + readers
+    double   lag_max_ms;
+    double   lag_avg_ms;
+    uint64_t dropped_pages;
+    unsigned long resync;
+    double   p50, p99, p999, pmax;  // latency us
+    int      ok;
+} result_t;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static double cpu(int who)
+{
+    struct rusage ru;
+    getrusage(who, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 +
+	ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+}
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void reader(shared_t* sh, int k)
+{
+    reader_stat_t* st = &sh->r[k];
+    sample_t buf[READ_BLOCK];
+    sample_t* data;
+    xample_t* xp;
+    uint64_t pos, first, start, end, sum = 0;
+
+    if ((xp = xample_open(NAME, 0, &data)) == NULL)
+	_exit(1);
+    pos = xample_seq(xp);
+    while(!sh->stop) {
+	uint64_t t, stamp, lag;
+
+	if (xample_wait(xp, pos, 100) <= 0)
+	    continue;
+	t = now_ns();
+	xample_window(xp, &start, &end);
+	if (end <= pos)
+	    continue;
+	st->wakeups++;
+	if ((st->nlat < MAX_LATENCY) &&
+	    (xample_time(xp, end-1, XAMPLE_CLOCK_MONOTONIC, &stamp) == 0)) {
+	    uint64_t d = (t > stamp) ? t - stamp : 0;
+	    st->lat[st->nlat++] = (d > UINT32_MAX) ? UINT32_MAX : d;
+	}
+	if (pos < start) {
+	    st->dropped += start - pos;
+	    pos = start;
+	}
+	first = pos;
+	while(pos < end) {
+	    size_t off = pos % xp->ring_samples;
+	    size_t n = end - pos;
+	    size_t i;
+	    if (n > READ_BLOCK)
+		n = READ_BLOCK;
+	    if (n > xp->ring_samples - off)
+		n = xp->ring_samples - off;
+	    xample_unpack(xp->format, data, off, n, buf);
+	    for (i = 0; i < n; i++)
+		sum += buf[i];
+	    pos += n;
+	    st->samples += n;
+	}
+	// overwritten while reading
+	xample_window(xp, &start, &end);
+	if (start > first)
+	    st->dropped += ((start < pos) ? start : pos) - first;
+	// published while reading
+	lag = xample_seq(xp) - pos;
+	if (lag > st->lag_max)
+	    st->lag_max = lag;
+	st->lag_sum += lag;
+    }
+    if (sum == 42)  // keep the loop
+	printf("\n");
+    xample_close(xp);
+    _exit(0);
+}
+
+static void run(shared_t* sh, size_t nchan, double rate, int nreaders,
+		int format, double secs, result_t* res)
+{
+    sample_t* data;
+    sample_t* chunk;
+    xample_t* xp;
+    xample_sim_t* sim;
+    xample_pace_t pace;
+    pid_t pid[MAX_READERS];
+    uint32_t* lat;
+    size_t nlat = 0, spf;
+    uint64_t seq = 0, lag_max = 0, dropped = 0, wakeups = 0;
+    double lag_sum = 0, t0, t1, c0, c1, period;
+    int k;
+
+    memset(res, 0, sizeof(result_t));
+    res->nchan = nchan;
+    res->rate = rate;
+    memset(sh, 0, sizeof(shared_t));
+    if ((xp = xample_create(NAME, (size_t) (rate*nchan*RING_SECS), 2, nchan,
+			    format, rate, 0600, 0, &data)) == NULL) {
+	fprintf(stderr, "unable to create %s\n", NAME);
+	exit(1);
+    }
+    spf = xp->samples_per_frame;
+    if ((chunk = malloc(spf*sizeof(sample_t))) == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    sim = xample_sim_new(nchan, rate, 1);
+
+    fflush(stdout);
+    for (k = 0; k < nreaders; k++) {
+	if ((pid[k] = fork()) == 0)
+	    reader(sh, k);
+    }
+    usleep(100000);  // readers opened
+
+    // pace per frame, busy tail when frames are short (as xample.c)
+    period = spf / (rate*nchan);
+    xample_pace_init(&pace, rate*nchan, (period < 100e-6) ? 50000 : 0);
+    c0 = cpu(RUSAGE_SELF);
+    t0 = now();
+    do {
+	xample_sim_fill(sim, chunk, spf);
+	xample_pack(format, chunk, spf, data, seq % xp->ring_samples);
+	seq += spf;
+	xample_pace_wait(&pace, spf);
+	xample_publish(xp, seq);
+	t1 = now();
+    } while(t1 - t0 < secs);
+    c1 = cpu(RUSAGE_SELF);
+
+    sh->stop = 1;
+    xample_publish(xp, seq);
+    for (k = 0; k < nreaders; k++)
+	waitpid(pid[k], NULL, 0);
+    // readers are reaped, children time is the sum of all runs so far
+    res->cpu = (c1 - c0) / (t1 - t0);
+    res->achieved = seq / (t1 - t0);
+    res->resync = pace.resync;
+
+    lat = malloc(nreaders*MAX_LATENCY*sizeof(uint32_t));
+    for (k = 0; k < nreaders; k++) {
+	reader_stat_t* st = &sh->r[k];
+	memcpy(lat + nlat, st->lat, st->nlat*sizeof(uint32_t));
+	nlat += st->nlat;
+	dropped += st->dropped;
+	wakeups += st->wakeups;
+	lag_sum += st->lag_sum;
+	if (st->lag_max > lag_max)
+	    lag_max = st->lag_max;
+    }
+    if (nlat > 0) {
+	qsort(lat, nlat, sizeof(uint32_t), cmp_u32);
+	res->p50  = lat[(size_t) (nlat*0.50)] / 1e3;
+	res->p99  = lat[(size_t) (nlat*0.99)] / 1e3;
+	res->p999 = lat[(size_t) (nlat*0.999)] / 1e3;
+	res->pmax = lat[nlat-1] / 1e3;
+    }
+    res->lag_max_ms = lag_max / (rate*nchan) * 1e3;
+    res->lag_avg_ms = (wakeups ? lag_sum / wakeups : 0) / (rate*nchan) * 1e3;
+    res->dropped_pages = (dropped + xp->samples_per_page - 1) /
+	xp->samples_per_page;
+    res->ok = (res->achieved >= 0.99*rate*nchan) && (res->resync == 0) &&
+	(dropped == 0);
+
+    free(lat);
+    free(chunk);
+    xample_sim_free(sim);
+    xample_close(xp);
+}
+
+static void print_result(result_t* r, int nreaders, int format,
+			 double reader_cpu, int json)
+{
+    double msps = r->rate*r->nchan/1e6;
+    double cpu = r->cpu + reader_cpu;
+
+    if (json) {
+	printf("{\"type\":\"run\",\"channels\":%zu,\"rate\":%.0f,"
+	       "\"readers\":%d,\"format\":\"%s\",\"target_msps\":%.4f,"
+	       "\"achieved_msps\":%.4f,\"ok\":%s,\"cpu_per_msps\":%.4f,"
+	       "\"producer_cpu\":%.4f,\"reader_cpu\":%.4f,"
+	       "\"lag_max_ms\":%.3f,\"lag_avg_ms\":%.3f,"
+	       "\"dropped_pages\":%llu,\"resync\":%lu,"
+	       "\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,"
+	       "\"max\":%.1f}}\n",
+	       r->nchan, r->rate, nreaders, xample_format_name(format),
+	       msps, r->achieved/1e6, r->ok ? "true" : "false",
+	       cpu/msps, r->cpu, reader_cpu, r->lag_max_ms, r->lag_avg_ms,
+	       (unsigned long long) r->dropped_pages, r->resync,
+	       r->p50, r->p99, r->p999, r->pmax);
+    }
+    else {
+	printf("%4zu %10.0f %9.3f %9.3f %4s %8.3f %8.2f %8.2f %7llu "
+	       "%8.1f %8.1f %8.1f %9.1f\n",
+	       r->nchan, r->rate, msps, r->achieved/1e6, r->ok ? "ok" : "FAIL",
+	       cpu/msps, r->lag_avg_ms, r->lag_max_ms,
+	       (unsigned long long) r->dropped_pages,
+	       r->p50, r->p99, r->p999, r->pmax);
+    }
+    fflush(stdout);
+}
+
+// parse a comma separated list of numbers
+static size_t parse_list(char* arg, double* v, size_t max)
+{
+    size_t n = 0;
+    char* end;
+
+    while((n < max) && (*arg != '\0')) {
+	v[n++] = strtod(arg, &end);
+	if (end == arg)
+	    return 0;
+	arg = (*end == ',') ? end+1 : end;
+    }
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    double chans[XAMPLE_MAX_CHANNELS] = { 1, 2, 8 };
+    double rates[32] = { 10e3, 100e3, 500e3, 1e6, 2e6, 5e6, 10e6, 20e6 };
+    size_t nchans = 3, nrates = 8, i, j;
+    int nreaders = 2;
+    int format = XAMPLE_FMT_U16;
+    double secs = 1.0;
+    int json = 0;
+    shared_t* sh;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "jr:c:f:d:x:")) != -1) {
+	switch(opt) {
+	case 'j':
+	    json = 1;
+	    break;
+	case 'r':
+	    nreaders = atoi(optarg);
+	    if ((nreaders < 1) || (nreaders > MAX_READERS)) {
+		fprintf(stderr, "readers must be 1..%d\n", MAX_READERS);
+		exit(1);
+	    }
+	    break;
+	case 'c':
+	    nchans = parse_list(optarg, chans, XAMPLE_MAX_CHANNELS);
+	    break;
+	case 'f':
+	    nrates = parse_list(optarg, rates, 32);
+	    break;
+	case 'd':
+	    secs = atof(optarg);
+	    break;
+	case 'x':
+	    if ((format = xample_format_parse(optarg)) < 0) {
+		fprintf(stderr, "unknown sample format '%s'\n", optarg);
+		exit(1);
+	    }
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-j] [-r <readers>] [-c <chan>,..] "
+		    "[-f <hz>,..] [-d <secs>] [-x <format>]\n", argv[0]);
+	    exit(1);
+	}
+    }
+    if ((nchans == 0) || (nrates == 0)) {
+	fprintf(stderr, "bad channel or rate list\n");
+	exit(1);
+    }
+    if ((sh = mmap(NULL, sizeof(shared_t), PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    if (!json)
+	printf("chan    rate/ch    target  achieved   ok  cpu/MSs  lag avg"
+	       "  lag max dropped   p50 us   p99 us  p999 us    max us\n");
+
+    for (i = 0; i < nchans; i++) {
+	size_t nchan = (size_t) chans[i];
+	double max_rate = 0;
+
+	if ((nchan < 1) || (nchan > XAMPLE_MAX_CHANNELS))
+	    continue;
+	for (j = 0; j < nrates; j++) {
+	    result_t r;
+	    double rc0 = cpu(RUSAGE_CHILDREN);
+	    double t0 = now(), reader_cpu;
+
+	    run(sh, nchan, rates[j], nreaders, format, secs, &r);
+	    // readers run from fork to reap, slightly longer than secs
+	    reader_cpu = (cpu(RUSAGE_CHILDREN) - rc0) / (now() - t0);
+	    print_result(&r, nreaders, format, reader_cpu, json);
+	    if (!r.ok)
+		break;
+	    max_rate = rates[j];
+	}
+	if (json)
+	    printf("{\"type\":\"summary\",\"channels\":%zu,\"readers\":%d,"
+		   "\"format\":\"%s\",\"max_rate\":%.0f,\"max_msps\":%.4f}\n",
+		   nchan, nreaders, xample_format_name(format), max_rate,
+		   max_rate*nchan/1e6);
+	else
+	    printf("%zu channels: max sustainable rate %.0f Hz "
+		   "(%.3f MS/s)\n", nchan, max_rate, max_rate*nchan/1e6);
+    }
+    shm_unlink(NAME);
+    return 0;
+}
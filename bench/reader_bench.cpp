@@ -0,0 +1,180 @@
+//
+// C++ reader interface benchmark
+//
+// A forked producer writes a ramp per channel (sample value is the
+// time step plus the channel number) at the given rate, paced per
+// frame, and publishes it. The parent follows the segment with
+// xample::reader, with the channel count as a compile time constant
+// and as a run time value, sums every channel through channel ranges
+// and checks each sample against the ramp. Samples overwritten while
+// they were read are not checked (segment::intact).
+//
+// usage: reader_bench [-c 2|4] [-f <hz>] [-d <secs>]
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "xample.hpp"
+
+#define NAME       "/xample_reader_bench"
+#define RING_SECS  0.5
+
+struct result {
+    std::uint64_t samples = 0;
+    std::uint64_t views = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t torn = 0;
+    std::uint64_t lost = 0;
+    std::uint64_t sum = 0;
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void producer(xample_t* xp, sample_t* data, double rate, double secs)
+{
+    std::size_t nchan = xp->channels;
+    std::size_t spf = xp->samples_per_frame;
+    std::uint64_t seq = 0;
+    xample_pace_t pace;
+    double t0 = now();
+
+    xample_pace_init(&pace, rate*nchan, 0);
+    while(now() - t0 < secs) {
+	for (std::size_t i = 0; i < spf; i++) {
+	    std::uint64_t s = seq + i;
+	    data[xample_offset(xp, s)] = sample_t(s/nchan + s%nchan);
+	}
+	seq += spf;
+	xample_pace_wait(&pace, spf);
+	xample_publish(xp, seq);
+    }
+    _exit(0);
+}
+
+// read until the producer stops, Channels may be dynamic_channels
+template <std::size_t Channels>
+static result follow(const xample::segment& seg, double secs)
+{
+    xample::reader<sample_t, Channels> rd(seg);
+    result r;
+    double t0 = now();
+
+    while(now() - t0 < secs + 0.5) {
+	auto v = rd.next(100);
+	if (v.empty())
+	    continue;
+	std::uint64_t step = v.seq() / v.channels();
+	std::uint64_t errors = 0;
+	for (std::size_t c = 0; c < v.channels(); c++) {
+	    std::uint64_t i = 0;
+	    for (auto x : v.channel(c)) {
+		errors += (x != sample_t(step + i + c));
+		r.sum += x;
+		i++;
+	    }
+	}
+	if (!seg.intact(v.seq()))
+	    r.torn++;
+	else
+	    r.errors += errors;
+	r.samples += v.size();
+	r.views++;
+    }
+    r.lost = rd.lost();
+    return r;
+}
+
+static result run(std::size_t nchan, double rate, double secs, bool fixed)
+{
+    sample_t* data;
+    xample_t* xp;
+    pid_t pid;
+    result r;
+
+    xp = xample_create(const_cast<char*>(NAME),
+		       std::size_t(rate*nchan*RING_SECS), 2, nchan,
+		       XAMPLE_FMT_U16, rate, 0600, 0, &data);
+    if (xp == nullptr) {
+	std::fprintf(stderr, "unable to create %s\n", NAME);
+	std::exit(1);
+    }
+    try {
+	xample::segment seg(NAME);
+	std::fflush(stdout);
+	if ((pid = fork()) == 0)
+	    producer(xp, data, rate, secs);
+	if (!fixed)
+	    r = follow<xample::dynamic_channels>(seg, secs);
+	else if (nchan == 2)
+	    r = follow<2>(seg, secs);
+	else
+	    r = follow<4>(seg, secs);
+	waitpid(pid, nullptr, 0);
+    }
+    catch (const std::exception& e) {
+	std::fprintf(stderr, "%s\n", e.what());
+	std::exit(1);
+    }
+    xample_close(xp);
+    return r;
+}
+
+static void usage(char* prog)
+{
+    std::printf("usage: %s [-c 2|4] [-f <hz>] [-d <secs>]\n", prog);
+    std::exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t nchan = 2;
+    double rate = 500000;
+    double secs = 2;
+    int errors = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:f:d:")) != -1) {
+	switch(opt) {
+	case 'c':
+	    nchan = std::size_t(atoi(optarg));
+	    if ((nchan != 2) && (nchan != 4))
+		usage(argv[0]);
+	    break;
+	case 'f':
+	    if ((rate = atof(optarg)) <= 0)
+		usage(argv[0]);
+	    break;
+	case 'd':
+	    if ((secs = atof(optarg)) <= 0)
+		usage(argv[0]);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+
+    std::printf("%-8s %10s %10s %10s %10s %8s %8s\n", "channels", "samples",
+		"views", "per view", "lost", "torn", "errors");
+    for (bool fixed : { true, false }) {
+	result r = run(nchan, rate, secs, fixed);
+	std::printf("%-8s %10llu %10llu %10.1f %10llu %8llu %8llu\n",
+		    fixed ? "fixed" : "dynamic",
+		    (unsigned long long) r.samples,
+		    (unsigned long long) r.views,
+		    r.views ? double(r.samples)/r.views : 0.0,
+		    (unsigned long long) r.lost,
+		    (unsigned long long) r.torn,
+		    (unsigned long long) r.errors);
+	errors += (r.errors > 0) || (r.samples == 0);
+    }
+    return errors ? 1 : 0;
+}
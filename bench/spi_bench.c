@@ -0,0 +1,125 @@
+//
+// MCP3202 response decode benchmark
+//
+// Decode synthetic SPI rx buffers (random bytes, so the bits outside
+// the 12 bit result are set too) with each kernel, check against a
+// reference decode, also deinterleaved for 1..8 channels, and report
+// the decode speed.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "xample.h"
+
+#define NFRAMES  (1024*1024)
+#define NROUNDS  20
+#define NCHECKS  2000
+
+static char* kernels[] = { "scalar", "ssse3", "neon", NULL };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static sample_t ref_decode(const uint8_t* rx)
+{
+    return (((rx[1] & 0xf) << 8) + rx[2]) << 4;
+}
+
+static int check(uint8_t* rx, sample_t* out)
+{
+    int i, errors = 0;
+
+    for (i = 0; i < NCHECKS; i++) {
+	size_t n   = rand() % 1000;
+	size_t off = rand() % 1024;
+	size_t nchan = 1 + rand() % XAMPLE_MAX_CHANNELS;
+	sample_t* planar[XAMPLE_MAX_CHANNELS];
+	size_t j, c;
+
+	out[n] = 0x5a5a;  // guard
+	xample_mcp3202_decode(rx + 3*off, n, out);
+	for (j = 0; j < n; j++) {
+	    if (out[j] != ref_decode(rx + 3*(off+j))) {
+		fprintf(stderr, "decode mismatch n=%zu at %zu\n", n, j);
+		errors++;
+		break;
+	    }
+	}
+	if (out[n] != 0x5a5a) {
+	    fprintf(stderr, "decode overrun n=%zu\n", n);
+	    errors++;
+	}
+	for (c = 0; c < nchan; c++)
+	    planar[c] = out + c*(n/nchan + 1);
+	xample_mcp3202_decode_planar(rx + 3*off, n, nchan, planar);
+	for (j = 0; j < n; j++) {
+	    if (planar[j % nchan][j / nchan] != ref_decode(rx + 3*(off+j))) {
+		fprintf(stderr, "planar mismatch n=%zu nchan=%zu at %zu\n",
+			n, nchan, j);
+		errors++;
+		break;
+	    }
+	}
+    }
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t* rx;
+    sample_t* out;
+    sample_t* planar[XAMPLE_MAX_CHANNELS];
+    int k, r, errors = 0;
+    size_t i, c;
+
+    rx  = malloc(3*NFRAMES);
+    out = malloc((NFRAMES + XAMPLE_MAX_CHANNELS)*sizeof(sample_t));
+    if ((rx == NULL) || (out == NULL)) {
+	perror("malloc");
+	exit(1);
+    }
+    for (i = 0; i < 3*NFRAMES; i++)
+	rx[i] = rand();
+
+    printf("%-8s %12s %12s %12s\n", "kernel", "Msample/s",
+	   "2ch Ms/s", "8ch Ms/s");
+    for (k = 0; kernels[k]; k++) {
+	double t0, t1, t2, t3;
+
+	if (xample_mcp3202_kernel(kernels[k]) < 0)
+	    continue;
+	errors += check(rx, out);
+
+	t0 = now();
+	for (r = 0; r < NROUNDS; r++)
+	    xample_mcp3202_decode(rx, NFRAMES, out);
+	t1 = now();
+	for (c = 0; c < 2; c++)
+	    planar[c] = out + c*(NFRAMES/2);
+	for (r = 0; r < NROUNDS; r++)
+	    xample_mcp3202_decode_planar(rx, NFRAMES, 2, planar);
+	t2 = now();
+	for (c = 0; c < 8; c++)
+	    planar[c] = out + c*(NFRAMES/8);
+	for (r = 0; r < NROUNDS; r++)
+	    xample_mcp3202_decode_planar(rx, NFRAMES, 8, planar);
+	t3 = now();
+	printf("%-8s %12.1f %12.1f %12.1f\n", kernels[k],
+	       (double) NFRAMES*NROUNDS/(t1-t0)/1e6,
+	       (double) NFRAMES*NROUNDS/(t2-t1)/1e6,
+	       (double) NFRAMES*NROUNDS/(t3-t2)/1e6);
+    }
+    if (errors) {
+	fprintf(stderr, "%d errors\n", errors);
+	exit(1);
+    }
+    return 0;
+}
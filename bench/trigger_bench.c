@@ -0,0 +1,247 @@
+//
+// Trigger scan micro benchmark
+//
+// Compare the per sample eval_trigger loop with the scan kernels,
+// check that all kernels find the same trigger index first.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "xample.h"
+
+#define NSAMPLES  (1024*1024)
+#define NROUNDS   50
+#define NCHECKS   2000
+
+static char* kernels[] = { "scalar", "sse2", "avx2", NULL };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// reference: the per sample eval_trigger loop
+static size_t eval_scan(trigger_t* t, unsigned char* m0, size_t nchan,
+			const sample_t* vec, size_t n, const sample_t* prev,
+			size_t chan0)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+	size_t ch = (chan0 + i) % nchan;
+	sample_t v0 = (i < nchan) ? prev[i] : vec[i-nchan];
+	unsigned char m = eval_trigger(vec[i], v0, &t[ch]);
+	if (m && ((m & DELTA_BITS) || ((m & ~m0[ch]) & LIMIT_BITS)))
+	    return i;
+    }
+    return n;
+}
+
+static void gen_samples(sample_t* vec, size_t n, int noise)
+{
+    size_t i;
+    long v = 32768;
+
+    for (i = 0; i < n; i++) {
+	v += (rand() % (2*noise+1)) - noise;
+	if (v < 1) v = 1;
+	if (v > 65534) v = 65534;
+	vec[i] = v;
+    }
+}
+
+static void gen_trigger(trigger_t* t)
+{
+    memset(t, 0, sizeof(trigger_t));
+    t->mask = rand() & (LIMIT_BITS|DELTA_BITS);
+    t->upper_limit = 32768 + rand() % 40000;
+    t->lower_limit = rand() % 40000;
+    t->delta = rand() % 300;
+    t->negative_delta = rand() % 300;
+    t->positive_delta = rand() % 300;
+}
+
+static int check(sample_t* vec)
+{
+    int i, k, errors = 0;
+
+    for (i = 0; i < NCHECKS; i++) {
+	trigger_t t[XAMPLE_MAX_CHANNELS];
+	unsigned char m0[XAMPLE_MAX_CHANNELS];
+	sample_t prev[XAMPLE_MAX_CHANNELS];
+	trigger_scan_t ts;
+	size_t nchan = 1 + rand() % XAMPLE_MAX_CHANNELS;
+	size_t chan0 = rand() % nchan;
+	size_t n   = rand() % 4096;
+	size_t off = rand() % 1024;
+	size_t j, r0;
+
+	for (j = 0; j < nchan; j++) {
+	    gen_trigger(&t[j]);
+	    m0[j] = rand() & LIMIT_BITS;
+	    prev[j] = rand();
+	}
+	xample_trigger_compile(&ts, t, m0, nchan);
+	r0 = eval_scan(t, m0, nchan, vec+off, n, prev, chan0);
+	for (k = 0; kernels[k]; k++) {
+	    size_t r;
+	    if (xample_trigger_kernel(kernels[k]) < 0)
+		continue;
+	    r = xample_trigger_scan(&ts, vec+off, n, prev, chan0);
+	    if (r != r0) {
+		fprintf(stderr, "%s: mismatch nchan=%zu n=%zu %zu != %zu\n",
+			kernels[k], nchan, n, r, r0);
+		errors++;
+	    }
+	}
+    }
+    return errors;
+}
+
+// a simple trigger as expression must fire on the same samples as the
+// scan kernel, also when scanning restart after each trigger
+static int check_expr(sample_t* vec)
+{
+    int i, errors = 0;
+
+    for (i = 0; i < NCHECKS/10; i++) {
+	trigger_t t;
+	unsigned char m0 = 0;
+	trigger_scan_t ts;
+	trigger_expr_t* e;
+	char text[256];
+	size_t n = rand() % 8192;
+	size_t chunk = 1 + rand() % 3000;
+	size_t i0 = 0, i1 = 0;
+	sample_t prev = 0;
+
+	do {
+	    gen_trigger(&t);
+	    t.channel = TRIGGER_ANY_CHANNEL;
+	} while(t.mask == 0);
+	snprintf(text, sizeof(text), "u:%lu:l:%lu:d:%lu:n:%lu:p:%lu",
+		 t.upper_limit, t.lower_limit, t.delta,
+		 t.negative_delta, t.positive_delta);
+	t.mask = LIMIT_BITS | DELTA_BITS;
+	xample_trigger_compile(&ts, &t, &m0, 1);
+	e = xample_trigger_expr_parse(text);
+	xample_trigger_expr_compile(e, 1, 1000.0);
+	while((i0 < n) || (i1 < n)) {
+	    size_t r0, r1;
+	    r0 = i0 + xample_trigger_scan(&ts, vec+i0, n-i0,
+					  i0 ? vec+i0-1 : &prev, 0);
+	    r1 = i1;
+	    while(r1 < n) {
+		size_t m = (n-r1 < chunk) ? n-r1 : chunk;
+		size_t r = xample_trigger_expr_scan(e, vec+r1, m,
+						    r1 ? vec+r1-1 : &prev, r1);
+		r1 += r;
+		if (r < m)
+		    break;
+	    }
+	    if (r0 != r1) {
+		fprintf(stderr, "expr: mismatch %s %zu != %zu\n", text, r1, r0);
+		errors++;
+		break;
+	    }
+	    i0 = r0+1;
+	    i1 = r1+1;
+	}
+	xample_trigger_expr_free(e);
+    }
+    return errors;
+}
+
+static void report(char* name, double t)
+{
+    double ms = ((double)NSAMPLES*NROUNDS)/t/1e6;
+    printf("%-8s %10.1f Msamples/s %8.3f ns/sample\n", name, ms, 1000.0/ms);
+}
+
+static void bench(sample_t* vec, size_t nchan)
+{
+    trigger_t t[XAMPLE_MAX_CHANNELS];
+    unsigned char m0[XAMPLE_MAX_CHANNELS];
+    trigger_scan_t ts;
+    volatile size_t r = 0;
+    char name[32];
+    double t0;
+    size_t j;
+    int i, k;
+
+    // all conditions enabled but never fire, worst case full scan
+    for (j = 0; j < nchan; j++) {
+	memset(&t[j], 0, sizeof(trigger_t));
+	t[j].mask = LIMIT_BITS | DELTA_BITS;
+	t[j].upper_limit = 65535;
+	t[j].lower_limit = 0;
+	t[j].delta = t[j].negative_delta = t[j].positive_delta = 1000 + j;
+	m0[j] = 0;
+    }
+    xample_trigger_compile(&ts, t, m0, nchan);
+
+    t0 = now();
+    for (i = 0; i < NROUNDS; i++)
+	r += eval_scan(t, m0, nchan, vec+nchan, NSAMPLES-nchan, vec, 0);
+    snprintf(name, sizeof(name), "eval/%zu", nchan);
+    report(name, now()-t0);
+
+    for (k = 0; kernels[k]; k++) {
+	snprintf(name, sizeof(name), "%s/%zu", kernels[k], nchan);
+	if (xample_trigger_kernel(kernels[k]) < 0) {
+	    printf("%-8s not supported\n", name);
+	    continue;
+	}
+	t0 = now();
+	for (i = 0; i < NROUNDS; i++)
+	    r += xample_trigger_scan(&ts, vec+nchan, NSAMPLES-nchan, vec, 0);
+	report(name, now()-t0);
+    }
+}
+
+static void bench_expr(sample_t* vec, size_t nchan, char* text)
+{
+    trigger_expr_t* e = xample_trigger_expr_parse(text);
+    volatile size_t r = 0;
+    char name[64];
+    double t0;
+    int i;
+
+    xample_trigger_expr_compile(e, nchan, 1000.0);
+    t0 = now();
+    for (i = 0; i < NROUNDS; i++)
+	r += xample_trigger_expr_scan(e, vec+nchan, NSAMPLES-nchan, vec,
+				      (uint64_t) i*NSAMPLES);
+    snprintf(name, sizeof(name), "expr/%zu", nchan);
+    report(name, now()-t0);
+    printf("  %s\n", text);
+    xample_trigger_expr_free(e);
+}
+
+int main(int argc, char** argv)
+{
+    sample_t* vec;
+
+    srand(1);
+    if ((vec = malloc(NSAMPLES*sizeof(sample_t))) == NULL)
+	exit(1);
+
+    gen_samples(vec, NSAMPLES, 500);
+    if ((check(vec) != 0) || (check_expr(vec) != 0))
+	exit(1);
+    printf("check ok (%d random triggers)\n", NCHECKS);
+
+    gen_samples(vec, NSAMPLES, 20);
+    bench(vec, 1);
+    bench(vec, 3);
+    bench(vec, 4);
+    bench_expr(vec, 1, "u:65535:l:0:d:1000:p:1000:n:1000");
+    bench_expr(vec, 4, "u:65535:l:0:d:1000:p:1000:n:1000");
+    bench_expr(vec, 4, "(c:0:u:65000:h:100&!c:1:w:0:10):N:5|c:2:o:0:65535:H:10");
+    return 0;
+}
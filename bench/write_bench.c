@@ -0,0 +1,146 @@
+//
+// Log file write benchmark
+//
+// Write pages from a shared memory ring to a file, the way the logger
+// does, with stdio (fwrite, one extra copy into the stdio buffer) and
+// with pwritev straight from the mapping (with and without fallocate).
+// Reports sustained MB/s and CPU ms per MB (user+sys).
+//
+// usage: write_bench [<dir>] [<MB>]
+//
+#if defined(__linux__)
+#define _GNU_SOURCE   // fallocate
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define RING_SIZE   (4*1024*1024)  // ring bytes
+#define BATCH_SIZE  (64*1024)      // bytes per write (logger page batch)
+#define RING_SKEW   4096           // make some writes wrap the ring
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static double cpu(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 +
+	ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+}
+
+static void report(char* name, size_t bytes, double t, double c)
+{
+    double mb = bytes / (1024.0*1024.0);
+    printf("%-18s %8.1f MB/s %8.3f cpu ms/MB\n", name, mb/t, 1000*c/mb);
+}
+
+static void write_stdio(char* path, uint8_t* ring, size_t total)
+{
+    size_t pos = RING_SKEW, done;
+    FILE* f;
+
+    if ((f = fopen(path, "w")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    for (done = 0; done < total; done += BATCH_SIZE) {
+	size_t n = RING_SIZE - pos;
+	if (n >= BATCH_SIZE)
+	    fwrite(ring + pos, 1, BATCH_SIZE, f);
+	else {
+	    fwrite(ring + pos, 1, n, f);
+	    fwrite(ring, 1, BATCH_SIZE - n, f);
+	}
+	pos = (pos + BATCH_SIZE) % RING_SIZE;
+    }
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+}
+
+static void write_pwritev(char* path, uint8_t* ring, size_t total,
+			  int prealloc)
+{
+    size_t pos = RING_SKEW, done;
+    int fd;
+
+    if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+	perror(path);
+	exit(1);
+    }
+#if defined(__linux__)
+    if (prealloc)
+	fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, total);
+#endif
+    for (done = 0; done < total; done += BATCH_SIZE) {
+	struct iovec iov[2];
+	size_t n = RING_SIZE - pos;
+	int cnt = 1;
+	iov[0].iov_base = ring + pos;
+	iov[0].iov_len  = (n >= BATCH_SIZE) ? BATCH_SIZE : n;
+	if (n < BATCH_SIZE) {
+	    iov[1].iov_base = ring;
+	    iov[1].iov_len  = BATCH_SIZE - n;
+	    cnt = 2;
+	}
+	if (pwritev(fd, iov, cnt, done) != BATCH_SIZE) {
+	    perror("pwritev");
+	    exit(1);
+	}
+	pos = (pos + BATCH_SIZE) % RING_SIZE;
+    }
+    fsync(fd);
+    close(fd);
+}
+
+int main(int argc, char** argv)
+{
+    char*  dir = (argc > 1) ? argv[1] : "/tmp";
+    size_t total = ((argc > 2) ? atoi(argv[2]) : 256) * 1024UL*1024UL;
+    char   path[1024];
+    uint8_t* ring;
+    double t0, c0;
+    int i;
+
+    // shared mapping like the xample data area
+    ring = mmap(NULL, RING_SIZE, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    for (i = 0; i < RING_SIZE; i++)
+	ring[i] = rand();
+    snprintf(path, sizeof(path), "%s/write_bench.tmp", dir);
+    total -= total % BATCH_SIZE;
+
+    for (i = 0; i < 2; i++) {  // second round is the reported one
+	t0 = now(); c0 = cpu();
+	write_stdio(path, ring, total);
+	if (i) report("stdio", total, now()-t0, cpu()-c0);
+
+	t0 = now(); c0 = cpu();
+	write_pwritev(path, ring, total, 0);
+	if (i) report("pwritev", total, now()-t0, cpu()-c0);
+
+	t0 = now(); c0 = cpu();
+	write_pwritev(path, ring, total, 1);
+	if (i) report("pwritev+fallocate", total, now()-t0, cpu()-c0);
+    }
+    unlink(path);
+    return 0;
+}
@@ -9,13 +9,14 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <math.h>
+#include <signal.h>
 #include <sys/time.h>
 #include <sys/mman.h>
 
 #include "xample.h"
 
 #define MIN_CHUNK_SIZE 1
-#define MAX_CHUNK_SIZE 256
+#define MAX_CHUNK_SIZE 4096
 #define DEF_CHUNK_SIZE 10
 
 #if defined(__linux__)
@@ -29,6 +30,9 @@
 
 static char* spi_dev = "/dev/spidev0.0";
 static int spi_fd = -1;
+static xample_spi_t* spi_engine = NULL;
+static size_t spi_batch = DEF_CHUNK_SIZE;  // transfers per engine buffer
+static size_t spi_nbuf = 2;                // 2 = double buffered
 
 int open_spi(void)
 {
@@ -84,39 +88,21 @@ sample_t read_sample_spi(int channel)
     return v << 4;  // scale to 16 bit
 }
 
-//  read n (nchan interleaved) samples
-int read_n_samples_spi(int* selector, size_t nchan, uint16_t delay,
+//  read n (nchan interleaved) samples, the acquisition engine is
+//  started on first read and runs continuously from channel 0, so the
+//  rotated selector is not needed
+int read_n_samples_spi(int* selector, size_t nchan, xample_pace_t* pace,
 		       sample_t* samples, size_t n)
 {
-  uint8_t rx[3*256];
-  uint8_t tx[3*256];
-  struct spi_ioc_transfer tr[256];
-  int i, j, k;
-  uint16_t delay1 = delay / nchan;
-
-  if (n > 256)
-      n = 256;
-
-  for (i=0,j=0,k=0; i < n; i++,j+=3) {
-    tx[j+0] = 1;
-    tx[j+1] = (2+selector[k++]) << 6;
-    tx[j+2] = 0;
-    if (k >= nchan) k = 0;
-    tr[i].tx_buf = (unsigned long) &tx[j];
-    tr[i].rx_buf = (unsigned long) &rx[j];
-    tr[i].len = 3;
-    tr[i].delay_usecs = delay1;
-    tr[i].speed_hz = SPI_SPEED;
-    tr[i].bits_per_word = 8;
-    tr[i].cs_change = 1;
-  }
-  if (ioctl(spi_fd, SPI_IOC_MESSAGE(n), &tr) < 0)
-    return 0;
-  for (i=0,j=0; i < n; i++,j+=3) {
-      sample_t v = (((rx[j+1] & 0xf)<<8) + rx[j+2])<<4;
-      samples[i] = v;
-  }
-  return n;
+    if (spi_engine == NULL) {
+	int fd = (strcmp(spi_dev, "mock") == 0) ? -1 : spi_fd;
+	if ((spi_engine = xample_spi_start(fd, SPI_SPEED, selector, nchan,
+					   spi_batch, spi_nbuf, pace)) == NULL) {
+	    fprintf(stderr, "unable to start spi engine\n");
+	    exit(1);
+	}
+    }
+    return xample_spi_read(spi_engine, samples, n);
 }
 
 #endif
@@ -174,16 +160,20 @@ int read_sample_hid(int* selector, sample_t* samples, size_t n)
     return r;
 }
 
-int read_n_samples_hid(int* selector, size_t nchan, uint16_t delay,
+int read_n_samples_hid(int* selector, size_t nchan, xample_pace_t* pace,
 		       sample_t* samples, size_t n)
 {
     int k = 0;
     while(n > 0) {
-	read_sample_hid(selector, samples, nchan);
-	n -= nchan;
-	samples += nchan;
-	k += nchan;
-	usleep(delay);  // fixme: pace this
+	size_t m = (n < nchan) ? n : nchan;
+	uint64_t t0 = xample_pace_clock();
+	read_sample_hid(selector, samples, m);
+	if (pace->stat)
+	    xample_stat_read(pace->stat, xample_pace_clock() - t0);
+	n -= m;
+	samples += m;
+	k += m;
+	xample_pace_wait(pace, m);
     }
     return k;
 }
@@ -191,57 +181,113 @@ int read_n_samples_hid(int* selector, size_t nchan, uint16_t delay,
 #endif
 
 
-#define MAX_AMPLITUDE  20000.0
-#define MIN_AMPLITUDE  1000.0
-#define OFFSET      3000.0
+static xample_sim_t* sim = NULL;
+static char*  sim_spec[XAMPLE_MAX_CHANNELS+1];  // last = all channels
+static uint64_t sim_seed = 1;
 
-sample_t read_sample_sim(int channel)
+// simulated samples, continuous from channel 0 (rotated selector not
+// needed), paced per chunk
+int read_n_samples_sim(int* selector, size_t nchan,
+		       xample_pace_t* pace, sample_t* samples, size_t n)
 {
-    static double x = 0.0;
-    static double ax = 0.0;
-    static double ad = 0.01;
-    double xi;
-    double vf;
-
-    switch(channel) {
-    case 0: xi = 0.0*M_PI/4.0; break;
-    case 1: xi = 1.0*M_PI/4.0; break;
-    case 2: xi = 2.0*M_PI/4.0; break;
-    case 3: xi = 3.0*M_PI/4.0; break;
-    default: xi = 0.0; break;
-    }
+    uint64_t t0 = xample_pace_clock();
 
-    x += channel*M_PI;
-    vf = (MIN_AMPLITUDE + ax*(MAX_AMPLITUDE-MIN_AMPLITUDE))*sin(xi+x*2*M_PI);
-    vf += OFFSET;
-    
-    ax += ad;
-    if (ax < 0.0) {
-	ax = 0.0;
-	ad = -ad;
-    }
-    else if (ax >= 1.0) {
-	ax = 1.0;
-	ad = -ad;
-    }
-    x += 0.01;
-    if (x >= 1.0) x = 0.0;
-    return (sample_t) (32767+(long)vf);
+    xample_sim_fill(sim, samples, n);
+    if (pace->stat)
+	xample_stat_read(pace->stat, xample_pace_clock() - t0);
+    xample_pace_wait(pace, n);
+    return n;
 }
 
-int read_n_samples_sim(int* selector, size_t nchan,
-		       uint16_t delay, sample_t* samples, size_t n)
+// lossless mode: wait until the frame from seq can be written without
+// lapping a live critical reader, return the time waited in us
+static long wait_readers(xample_t* xp, uint64_t seq)
 {
-  int i,k;
+    struct timeval t0, t1;
+    long us = 0;
 
-  for (i=0,k=0; i < n; i++) {
-      samples[i] = read_sample_sim(selector[k++]);
-      if (k >= nchan) {
-	  k = 0;
-	  usleep(delay);
-      }
-  }
-  return n;
+    if (seq + xp->samples_per_frame <=
+	xample_reader_scan(xp, seq) + xp->ring_samples)
+	return 0;
+    gettimeofday(&t0, NULL);
+    xp->blocked = 1;
+    do {
+	usleep(200);
+    } while(seq + xp->samples_per_frame >
+	    xample_reader_scan(xp, seq) + xp->ring_samples);
+    xp->blocked = 0;
+    gettimeofday(&t1, NULL);
+    us = (t1.tv_sec-t0.tv_sec)*1000000+(t1.tv_usec-t0.tv_usec);
+    return us;
+}
+
+// Adaptive chunk size. Every ADAPT_INTERVAL_NS the counters in the
+// segment are compared with the last decision: the chunk is doubled
+// when the achieved rate is behind (also beyond the latency target,
+// a wrong rate is worse) or when more than half the time is spent in
+// device reads and the doubled chunk still fits the latency target,
+// it is halved when a chunk takes longer than the latency target.
+#define ADAPT_INTERVAL_NS  200000000
+#define ADAPT_BEHIND       0.98   // achieved/nominal samples
+#define ADAPT_BUSY         0.5    // fraction of time in device reads
+
+typedef struct {
+    uint64_t t;            // time of last decision
+    uint64_t samples;      // counters at t
+    uint64_t read_ns;
+    uint64_t blocked_ns;
+} adapt_t;
+
+static void adapt_init(adapt_t* a, xample_t* xp)
+{
+    a->t = xample_pace_clock();
+    a->samples = xp->stat.samples;
+    a->read_ns = xp->stat.read_ns;
+    a->blocked_ns = xp->stat.blocked_ns;
+}
+
+// tick_ns is the time per sample (all channels), return the chunk size
+static size_t adapt_chunk(xample_t* xp, adapt_t* a, size_t chunk,
+			  size_t max_chunk, double tick_ns, double target_ns)
+{
+    xample_stat_t* st = &xp->stat;
+    uint64_t now = xample_pace_clock();
+    double dt, busy, expect;
+    int reason = XAMPLE_CHUNK_FIXED;
+    size_t next = chunk;
+
+    if (now - a->t < ADAPT_INTERVAL_NS)
+	return chunk;
+    // time waiting for readers is not acquisition time
+    dt = (double) (now - a->t) - (double) (st->blocked_ns - a->blocked_ns);
+    busy = (double) (st->read_ns - a->read_ns) / dt;
+    expect = dt / tick_ns;
+    // samples count whole frames, allow one more
+    if ((double) (st->samples - a->samples + xp->samples_per_frame) <
+	ADAPT_BEHIND*expect) {
+	if (chunk < max_chunk)
+	    reason = XAMPLE_CHUNK_BEHIND;
+    }
+    else if ((busy > ADAPT_BUSY) && (chunk < max_chunk) &&
+	     (2*chunk*tick_ns <= target_ns))
+	reason = XAMPLE_CHUNK_OVERHEAD;
+    else if ((chunk > MIN_CHUNK_SIZE) && (chunk*tick_ns > target_ns))
+	reason = XAMPLE_CHUNK_LATENCY;
+
+    if (reason == XAMPLE_CHUNK_LATENCY) {
+	next = chunk / 2;
+	xample_stat_add(&st->chunk_shrink, 1);
+    }
+    else if (reason != XAMPLE_CHUNK_FIXED) {
+	next = (2*chunk > max_chunk) ? max_chunk : 2*chunk;
+	xample_stat_add(&st->chunk_grow, 1);
+    }
+    if (next != chunk) {
+	__atomic_store_n(&st->chunk, next, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->chunk_reason, reason, __ATOMIC_RELAXED);
+    }
+    adapt_init(a, xp);
+    return next;
 }
 
 void usage(char* prog)
@@ -250,18 +296,48 @@ void usage(char* prog)
     printf("  [-t <secs>]         max buffer time in seconds\n"
 	   "  [-f <freq-hz>]      sample frequency in hertz\n"
 	   "  [-d <frame-div>]    page divider into frames\n"
-	   "  [-k <chunk-size>]   chunk size 1..256 (10)\n"
+	   "  [-k <chunk-size>]   chunk size 1..4096 (10)\n"
 	   "  [-c <channels>]     number of channels 1..8\n"
-	   "  [-i <n>]            select spi interface 0 or 1\n"
+	   "  [-i <n>|mock]       select spi interface 0 or 1, or a\n"
+	   "                      mock MCP3202 (sawtooth per channel)\n"
+	   "  [-A <buffers>]      spi batch buffers 2..3 (2)\n"
 	   "  [-s]                run simulated mode\n"
+	   "  [-g [<chan>=]<spec>] simulated signal, all channels without\n"
+	   "                      chan, spec see xample_sim.c, ex:\n"
+	   "                      sine:f:50:a:20000:n:100:p:5000:h:8000\n"
+	   "  [-R <seed>]         simulator seed (1)\n"
 	   "  [-v <usb-vendor>]   hid mode usb vendor\n"
 	   "  [-p <usb-product>]  hid mode usb product\n"
 	   "  [-S <usb-serial>]   hid mode usb serial\n"
 	   "  [-H <product-name>] hid mode product select\n"
+	   "  [-P <prio>]         run with SCHED_FIFO priority\n"
+	   "  [-C <cpu>]          pin to cpu\n"
+	   "  [-L]                lock memory (mlockall)\n"
+	   "  [-B <usecs>]        busy wait before each deadline\n"
+	   "                      (default 50 when the period < 100us)\n"
+	   "  [-u]                use huge pages (hugetlbfs path or\n"
+	   "                      " XAMPLE_HUGETLBFS ", else transparent)\n"
+	   "  [-F]                prefault the sample ring\n"
+	   "  [-x <format>]       sample format u8, u12p, u16 (default),\n"
+	   "                      u32 or f32\n"
+	   "  [-W]                lossless, wait instead of overwriting\n"
+	   "                      samples a critical reader still needs\n"
+	   "  [-q]                quiet, no per page report (see xample_stat)\n"
+	   "  [-a]                adapt the chunk size to the device read\n"
+	   "                      overhead and the latency target\n"
+	   "  [-T <usecs>]        adaptive latency target (one frame)\n"
 	);
     exit(1);
 }
 
+static volatile sig_atomic_t stop = 0;
+
+static void stop_handler(int sig)
+{
+    (void) sig;
+    stop = 1;
+}
+
 int main(int argc, char** argv)
 {
     size_t max_samples;
@@ -279,21 +355,40 @@ int main(int argc, char** argv)
     size_t frames_per_page;
     unsigned long udelay;
     unsigned long nsamples = 0;
+    uint64_t seq = 0;
     long sample_time = 5;
     sample_t* sample_buffer;
     xample_t* xp;
     double rate;
     double sample_freq = 1000.0;  // default = 1K HZ
-    int i, f, opt;
+    int i, f, k, opt;
     size_t fdivpow2 = 2;    // 0 => 2^0 = 1 => frame_size = page_size 
     // sample_t (*read_sample_fn)(int channel) = NULL;
-    int (*read_n_samples_fn)(int*, size_t, uint16_t, sample_t*, size_t) = NULL;
+    int (*read_n_samples_fn)(int*, size_t, xample_pace_t*, sample_t*, size_t) = NULL;
     struct timeval t0, t1;
     size_t chunk_size = DEF_CHUNK_SIZE;
     size_t nchannels = 1;
-    int    selector[8];
-
-    while ((opt = getopt(argc, argv, "sf:t:d:i:c:v:p:S:H:")) != -1) {
+    int    selector[XAMPLE_MAX_CHANNELS];
+    int    rselector[XAMPLE_MAX_CHANNELS];
+    size_t chan = 0;  // channel of next sample
+    xample_pace_t pace;
+    long   busy_us = -1;  // -1 = auto
+    int    rt_prio = 0;
+    int    rt_cpu = -1;
+    int    rt_lock = 0;
+    int    map_flags = 0;
+    int    format = XAMPLE_FMT_U16;
+    sample_t chunk[MAX_CHUNK_SIZE];  // converted to format
+    int    lossless = 0;
+    int    quiet = 0;
+    int    adaptive = 0;
+    double target_us = 0;  // 0 = one frame
+    double tick_ns;
+    adapt_t adapt;
+    long   blocked_us = 0;
+    struct sigaction sa;
+
+    while ((opt = getopt(argc, argv, "sf:t:d:k:i:c:v:p:S:H:P:C:LB:uFx:A:g:R:WqaT:")) != -1) {
 	switch(opt) {
 	case 'f':
 	    sample_freq = atof(optarg);  // sample frequency
@@ -307,6 +402,42 @@ int main(int argc, char** argv)
 	case 'c':
 	    nchannels = atoi(optarg);
 	    break;
+	case 'P':
+	    rt_prio = atoi(optarg);
+	    break;
+	case 'C':
+	    rt_cpu = atoi(optarg);
+	    break;
+	case 'L':
+	    rt_lock = 1;
+	    break;
+	case 'B':
+	    busy_us = atol(optarg);
+	    break;
+	case 'u':
+	    map_flags |= XAMPLE_MAP_HUGE;
+	    break;
+	case 'F':
+	    map_flags |= XAMPLE_MAP_POPULATE;
+	    break;
+	case 'W':
+	    lossless = 1;
+	    break;
+	case 'q':
+	    quiet = 1;
+	    break;
+	case 'a':
+	    adaptive = 1;
+	    break;
+	case 'T':
+	    target_us = atof(optarg);
+	    break;
+	case 'x':
+	    if ((format = xample_format_parse(optarg)) < 0) {
+		fprintf(stderr, "unknown sample format '%s'\n", optarg);
+		exit(1);
+	    }
+	    break;
 	case 'k':
 	  chunk_size = atoi(optarg);
 	  if (chunk_size < MIN_CHUNK_SIZE) 
@@ -316,7 +447,9 @@ int main(int argc, char** argv)
 	  break;
 	case 'i':
 #if defined(__linux__) && defined(MCP3202)
-	  if (atoi(optarg) == 1)
+	  if (strcmp(optarg, "mock") == 0)
+	    spi_dev = "mock";
+	  else if (atoi(optarg) == 1)
 	    spi_dev = "/dev/spidev0.1";
 	  else
 	    spi_dev = "/dev/spidev0.0";
@@ -325,6 +458,32 @@ int main(int argc, char** argv)
 	case 's':
 	  read_n_samples_fn = read_n_samples_sim;
 	  break;
+	case 'g': {
+	  char* eq = strchr(optarg, '=');
+	  if (eq == NULL)
+	      sim_spec[XAMPLE_MAX_CHANNELS] = optarg;
+	  else {
+	      int c = atoi(optarg);
+	      if ((c < 0) || (c >= XAMPLE_MAX_CHANNELS)) {
+		  fprintf(stderr, "bad channel in '%s'\n", optarg);
+		  exit(1);
+	      }
+	      sim_spec[c] = eq+1;
+	  }
+	  break;
+	}
+	case 'R':
+	  sim_seed = strtoull(optarg, NULL, 0);
+	  break;
+#if defined(__linux__) && defined(MCP3202)
+	case 'A':
+	  spi_nbuf = atoi(optarg);
+	  if (spi_nbuf < 2)
+	    spi_nbuf = 2;
+	  else if (spi_nbuf > 3)
+	    spi_nbuf = 3;
+	  break;
+#endif
 #if defined(USE_HIDAPI)
 	case 'v':
 	    hid_vendor = atoi(optarg);
@@ -357,6 +516,28 @@ int main(int argc, char** argv)
     if (optind >= argc)
 	usage(argv[0]);
 
+    if ((nchannels < 1) || (nchannels > XAMPLE_MAX_CHANNELS)) {
+	fprintf(stderr, "number of channels must be 1..%d\n",
+		XAMPLE_MAX_CHANNELS);
+	exit(1);
+    }
+
+    if (read_n_samples_fn == read_n_samples_sim) {
+	if ((sim = xample_sim_new(nchannels, sample_freq, sim_seed)) == NULL) {
+	    fprintf(stderr, "unable to create simulator\n");
+	    exit(1);
+	}
+	for (i = 0; i < nchannels; i++) {
+	    char* spec = sim_spec[i] ? sim_spec[i] :
+		sim_spec[XAMPLE_MAX_CHANNELS];
+	    if ((spec != NULL) && (xample_sim_config(sim, i, spec) < 0)) {
+		fprintf(stderr, "bad signal spec '%s'\n", spec);
+		exit(1);
+	    }
+	}
+	printf("sim seed = %llu\n", (unsigned long long) sim_seed);
+    }
+
     // setup channel selector just a simple one-to-one map for now
     for (i = 0; i < nchannels; i++)
 	selector[i] = i;
@@ -374,6 +555,10 @@ int main(int argc, char** argv)
 #endif
 
 #if defined(__linux__) && defined(MCP3202)
+    if ((read_n_samples_fn == NULL) && (strcmp(spi_dev, "mock") == 0)) {
+      read_n_samples_fn = read_n_samples_spi;
+      printf("spi mock device\n");
+    }
     if (read_n_samples_fn == NULL) {
       open_spi();
       if (spi_fd >= 0) {
@@ -383,12 +568,20 @@ int main(int argc, char** argv)
     }
 #endif
 
+#if defined(__linux__) && defined(MCP3202)
+    if (adaptive && (read_n_samples_fn == read_n_samples_spi)) {
+      // transfers are prebuilt for the batch size, chose it with -k
+      printf("adaptive chunk not used with the spi engine\n");
+      adaptive = 0;
+    }
+#endif
+
     max_samples = (size_t)(sample_freq*sample_time);
     udelay = ((unsigned long)(1000000*(1/sample_freq)));
     
     // frame div pow = 2 => (1 << 2) == 4  (four frames per page)
     if ((xp = xample_create(argv[optind], max_samples, fdivpow2,
-			    nchannels, sample_freq, 0666,
+			    nchannels, format, sample_freq, 0666, map_flags,
 			    &sample_buffer)) == NULL) {
 	fprintf(stderr, "unable to create shared memory %s\n", argv[optind]);
 	exit(1);
@@ -401,6 +594,9 @@ int main(int argc, char** argv)
     printf("udelay = %lu\n", udelay);
     printf("max_samples = %zu\n", max_samples);
     printf("chunk_size = %zu\n",  chunk_size);
+#if defined(__linux__) && defined(MCP3202)
+    spi_batch = chunk_size;
+#endif
    
     // page info
     current_page = xp->current_page;
@@ -413,6 +609,8 @@ int main(int argc, char** argv)
     printf("last_page = %lu\n",  last_page);
     printf("current_page = %lu\n", current_page);
     printf("samples_per_page = %zu\n", samples_per_page);
+    printf("map_size = %lu\n", xp->map_size);
+    printf("huge_page_size = %lu\n", xp->huge_page_size);
     
     // frame info
     current_frame = xp->current_frame;
@@ -428,28 +626,69 @@ int main(int argc, char** argv)
     printf("samples_per_frame = %zu\n", samples_per_frame);
     printf("frames_per_page = %zu\n", frames_per_page);
     printf("nchannels = %zu\n",  xp->channels);
+    printf("ring_samples = %lu\n", xp->ring_samples);
+    printf("format = %s\n", xample_format_name(format));
 
     first_frame_offset = first_frame*samples_per_frame;
     // first_page_offset = first_page*samples_per_page;
     frame_offset = first_frame_offset;
 
+    if (busy_us < 0)
+	busy_us = (udelay < 100) ? 50 : 0;
+    printf("busy_us = %ld\n", busy_us);
+    if ((rt_prio > 0) || (rt_cpu >= 0) || rt_lock)
+	xample_rt_setup(rt_prio, rt_cpu, rt_lock);
+
     // loop - sample data and save in shared memory
     i = 0;
     f = 0;
 
     gettimeofday(&t0, NULL);
-
-    while(1) {
+    // one tick per sample
+    xample_pace_init(&pace, sample_freq*nchannels, busy_us*1000);
+    pace.stat = &xp->stat;
+    xample_stat_add(&xp->stat.chunk, chunk_size);
+    tick_ns = 1e9 / (sample_freq*nchannels);
+    if (target_us <= 0)
+	target_us = samples_per_frame*tick_ns/1000.0;
+    adapt_init(&adapt, xp);
+    if (adaptive)
+	printf("adaptive chunk, target latency %.1f us\n", target_us);
+
+    // stop at the next chunk, the spi engine is shut down below
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while(!stop) {
       int ns = chunk_size;
       int remain = samples_per_frame - i;
-      uint16_t delay;
 
       if  (ns > remain)
 	ns = remain;
-      delay = (udelay > 65535) ? 65535 : udelay;
-      read_n_samples_fn(selector, nchannels,
-			delay, sample_buffer+frame_offset+i, ns);
+      if (lossless && (i == 0)) {
+	long us = wait_readers(xp, seq);
+	if (us > 0) {
+	  xample_stat_add(&xp->stat.blocked_ns, us*1000);
+	  blocked_us += us;
+	}
+      }
+      // chunks and frames are not multiple of nchannels, rotate
+      // the selector so sample seq is always from channel seq % nchannels
+      for (k = 0; k < nchannels; k++)
+	  rselector[k] = selector[(chan + k) % nchannels];
+      if (format == XAMPLE_FMT_U16)
+	read_n_samples_fn(rselector, nchannels,
+			  &pace, sample_buffer+frame_offset+i, ns);
+      else {
+	read_n_samples_fn(rselector, nchannels, &pace, chunk, ns);
+	xample_pack(format, chunk, ns, sample_buffer, frame_offset+i);
+      }
+      chan = (chan + ns) % nchannels;
       i += ns;
+      xample_stat_add(&xp->stat.chunks, 1);
+      xample_stat_hist(xp->stat.chunk_hist, ns);
 
 //      memcpy(last_sample, &sample_buffer[frame_offset+i-1],
 //            sizeof(sample_t)*nchannels);
@@ -458,6 +697,7 @@ int main(int argc, char** argv)
 	nsamples += samples_per_frame;
 	f++;
 	if (f >= frames_per_page) {
+	  xample_pace_t* pp = &pace;
 	  long td;
 	  if (current_page >= last_page)
 	    current_page = first_page;
@@ -469,9 +709,39 @@ int main(int argc, char** argv)
 	  gettimeofday(&t1, NULL);
 	  
 	  td = (t1.tv_sec-t0.tv_sec)*1000000+(t1.tv_usec-t0.tv_usec);
-	  printf("Hz = %f\n", 
-		 (((double)nsamples/nchannels)/(double) td)*1000000.0);
-	  printf("last_sample = %u\n", sample_buffer[frame_offset+i-ns]);
+	  __atomic_store_n(&xp->stat.rate_mhz, (uint64_t)
+			   ((((double)nsamples/nchannels)/(double) td)*1e9),
+			   __ATOMIC_RELAXED);
+#if defined(__linux__) && defined(MCP3202)
+	  xample_pace_t spi_pace;
+	  if (spi_engine != NULL) {
+	    // the engine thread paces, take its stats (and reset them)
+	    xample_spi_pace(spi_engine, &spi_pace, 1);
+	    pp = &spi_pace;
+	  }
+#endif
+	  if (!quiet) {
+	    printf("Hz = %f\n", 
+		   (((double)nsamples/nchannels)/(double) td)*1000000.0);
+	    xample_unpack(format, sample_buffer, frame_offset+i-ns, 1, chunk);
+	    printf("last_sample = %u\n", chunk[0]);
+	    xample_pace_print(pp);
+	    if (xp->reader_count > 0)
+	      printf("readers = %u, lag = %llu\n", xp->reader_count,
+		     (unsigned long long) xp->reader_lag);
+	    if (lossless)
+	      printf("blocked = %ld us\n", blocked_us);
+#if defined(__linux__) && defined(MCP3202)
+	    if (spi_engine != NULL) {
+	      unsigned long batches, stalls, errors;
+	      xample_spi_stat(spi_engine, &batches, &stalls, &errors);
+	      printf("spi: batches %lu, stalls %lu, errors %lu\n",
+		     batches, stalls, errors);
+	    }
+#endif
+	  }
+	  xample_pace_reset_stat(&pace);
+	  blocked_us = 0;
 	  nsamples = 0;
 	  t0 = t1;
 	}
@@ -485,6 +755,34 @@ int main(int argc, char** argv)
 	  frame_offset += samples_per_frame;
 	}
 	xp->current_frame = current_frame;
+	seq += samples_per_frame;
+	xample_publish(xp, seq);
+	__atomic_store_n(&xp->stat.samples, seq, __ATOMIC_RELAXED);
+	if (!lossless)  // else scanned before the next frame
+	  xample_reader_scan(xp, seq);
+	if (adaptive) {
+	  size_t k = adapt_chunk(xp, &adapt, chunk_size,
+				 (samples_per_frame < MAX_CHUNK_SIZE) ?
+				 samples_per_frame : MAX_CHUNK_SIZE,
+				 tick_ns, target_us*1000);
+	  if ((k != chunk_size) && !quiet)
+	    printf("chunk_size = %zu (%s)\n", k,
+		   (k < chunk_size) ? "latency" :
+		   ((xp->stat.chunk_reason == XAMPLE_CHUNK_BEHIND) ?
+		    "behind" : "overhead"));
+	  chunk_size = k;
+	}
       }
     }
+#if defined(__linux__) && defined(MCP3202)
+    if (spi_engine != NULL)
+      xample_spi_stop(spi_engine);
+    close_spi();
+#endif
+#if defined(USE_HIDAPI)
+    if (hid_dev != NULL)
+      close_hid();
+#endif
+    xample_close(xp);
+    return 0;
 }
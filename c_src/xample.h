@@ -1,5 +1,10 @@
 
 #ifndef __XAMPLE_H__
+#define __XAMPLE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 
 #ifdef __APPLE__
 #include <machine/endian.h>
@@ -16,9 +21,15 @@
 #include <endian.h>
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 typedef uint16_t sample_t;
 
+#define XAMPLE_MAX_CHANNELS 8
+
 //
 // Memory mapped structure
 // +---------------+
@@ -31,8 +42,16 @@ typedef uint16_t sample_t;
 // | sample rate   |
 // +---------------+
 // ...
+// +---------------+
+// |  seq lock     |
+// +---------------+
+// |  write seq    |
+// +---------------+
+// ...
 // +===============+
-// | page 1        |
+// | frame times   |  time_pages from time_page (1)
+// +===============+
+// | page 1        |  data from data_page
 // +===============+
 // | page 2        |
 // +===============+
@@ -46,6 +65,88 @@ typedef uint16_t sample_t;
 // framesize <= page_size and is normally
 // power of two (like a sub page)
 //
+// The data is stored in the segment sample format (XAMPLE_FMT_xxx).
+// Pages and frames are counted in samples, samples_per_frame is a
+// power of two and samples_per_page = samples_per_frame*frames_per_page.
+// frame_size is in bytes. Except for XAMPLE_FMT_U12P a sample page is
+// one memory page, packed 12 bit pages are 3/4 of a memory page.
+//
+// write_seq is the total number of samples written since create,
+// it is updated once per frame and never wraps. Sample number seq
+// is found at offset (seq % ring_samples) in the data area.
+// write_seq is published seqlock style, seq_lock is odd while the
+// producer is updating, so 32 bit readers never see a torn value.
+// wake_word is bumped on every publish, readers block on it (futex)
+// in xample_wait and register in waiters so the producer only
+// issue the wakeup system call when someone is waiting.
+//
+// The frame time table has one xample_time_t per frame in the ring,
+// frame f (samples f*samples_per_frame ..) is at index f % nframes.
+// The producer stamps the entry when the frame is published, so the
+// times are those of the last sample in the frame. Entry seq is the
+// end sample number of the frame, zero while it is updated.
+//
+// The geometry is always in system pages (page_size), also when the
+// segment is backed by huge pages. The data then starts on and fill
+// whole huge pages, map_size is the full length of the segment. The
+// data is last, so a reader may map it a second time directly after
+// the segment (XAMPLE_MAP_MIRROR). Then any ring_samples long range
+// from data+offset is contiguous in memory, across the wrap.
+//
+// Readers may register a cursor slot in the header: pid, read_seq
+// (the oldest sample the reader still needs) and a heartbeat. The
+// producer publishes the lag of the slowest live reader, and in
+// lossless mode it waits before lapping a XAMPLE_READER_CRITICAL
+// reader. A reader without heartbeat for XAMPLE_READER_TIMEOUT ms is
+// not waited for, slots of dead processes are reclaimed.
+//
+#define XAMPLE_MAX_READERS     16
+#define XAMPLE_READER_CRITICAL 0x01  // producer must not lap (lossless)
+#define XAMPLE_READER_TIMEOUT  2000  // ms without heartbeat = not live
+
+// Producer counters, updated with relaxed atomics (each counter has a
+// single writer, except overruns/lost that readers add to) and read
+// by xample_stat. Times in ns, histograms have log2 buckets: bucket k
+// counts values v with 2^(k-1) <= v < 2^k, bucket 0 counts v = 0.
+#define XAMPLE_STAT_BUCKETS 32
+
+typedef struct {
+    volatile uint64_t start_ns;     // CLOCK_REALTIME at create
+    volatile uint64_t samples;      // samples produced
+    volatile uint64_t rate_mhz;     // achieved rate (per channel, mHz)
+    volatile uint64_t reads;        // device reads (ioctl, hid_read, fill)
+    volatile uint64_t read_ns;      // total time in device reads
+    volatile uint64_t read_max_ns;
+    volatile uint64_t paced;        // pace waits
+    volatile uint64_t late_ns;      // total pace lateness
+    volatile uint64_t late_max_ns;
+    volatile uint64_t resyncs;      // pace schedule restarts
+    volatile uint64_t blocked_ns;   // lossless waits for readers
+    volatile uint64_t chunks;       // chunks read
+    volatile uint64_t chunk;        // current chunk size
+    volatile uint64_t chunk_grow;   // adaptive chunk size decisions
+    volatile uint64_t chunk_shrink;
+    volatile uint64_t chunk_reason; // last XAMPLE_CHUNK_xxx
+    volatile uint64_t overruns;     // reader overruns (added by readers)
+    volatile uint64_t lost;         // samples lost by readers
+    volatile uint64_t read_hist[XAMPLE_STAT_BUCKETS];   // read time
+    volatile uint64_t late_hist[XAMPLE_STAT_BUCKETS];   // pace lateness
+    volatile uint64_t chunk_hist[XAMPLE_STAT_BUCKETS];  // chunk sizes
+} xample_stat_t;
+
+// reasons for an adaptive chunk size change
+#define XAMPLE_CHUNK_FIXED    0  // not adaptive, or no change yet
+#define XAMPLE_CHUNK_BEHIND   1  // grow, achieved rate below nominal
+#define XAMPLE_CHUNK_OVERHEAD 2  // grow, device reads take the time
+#define XAMPLE_CHUNK_LATENCY  3  // shrink, chunk longer than target
+
+typedef struct {
+    volatile uint32_t pid;          // 0 = free slot
+    volatile uint32_t flags;        // XAMPLE_READER_xxx
+    volatile uint64_t read_seq;     // oldest sample still needed
+    volatile uint64_t heartbeat;    // CLOCK_MONOTONIC ns of last update
+} xample_reader_t;
+
 typedef struct {
     unsigned long current_page;      // current page number
     unsigned long first_page;        // first page number
@@ -62,8 +163,53 @@ typedef struct {
 
     unsigned long rate;             // sample rate 24.8 format
     unsigned long channels;         // number of channels (interleaved when > 1)
+                                    // sample seq is from channel seq % channels
+
+    unsigned long ring_samples;     // number of samples in all frames
+    volatile uint32_t seq_lock;     // odd while write_seq is updated
+    volatile uint64_t write_seq;    // number of samples written (monotonic)
+    volatile uint32_t wake_word;    // bumped on every publish
+    volatile uint32_t waiters;      // number of readers blocked in wait
+    unsigned long time_page;        // first page of frame time table
+    unsigned long time_pages;       // number of pages in time table
+    unsigned long map_flags;        // XAMPLE_MAP_* used by create
+    unsigned long map_size;         // mapped length in bytes
+    unsigned long huge_page_size;   // hugetlbfs page size, 0 = not hugetlbfs
+    unsigned long data_page;        // first data page
+    unsigned long format;           // sample format XAMPLE_FMT_xxx
+    unsigned long sample_bits;      // bits per sample in the ring
+    volatile uint64_t reader_lag;   // samples behind, slowest live reader
+    volatile uint32_t reader_count; // live readers at last scan
+    volatile uint32_t blocked;      // producer waits for a critical reader
+    xample_reader_t readers[XAMPLE_MAX_READERS];
+    xample_stat_t stat;             // producer counters
 } xample_t;
 
+// sample formats in the ring, converted from/to 16 bit sample_t
+#define XAMPLE_FMT_U16   0  // uint16_t, sample_t as is
+#define XAMPLE_FMT_U8    1  // uint8_t, top 8 bits
+#define XAMPLE_FMT_U12P  2  // top 12 bits, two samples packed in 3 bytes
+#define XAMPLE_FMT_U32   3  // uint32_t, sample << 16
+#define XAMPLE_FMT_F32   4  // float -1.0 .. 1.0 (offset binary 32768 = 0)
+
+// xample_create flags
+#define XAMPLE_MAP_HUGE      0x01  // huge pages (hugetlbfs or transparent)
+#define XAMPLE_MAP_POPULATE  0x02  // prefault the mapping (also readers)
+// xample_open flags
+#define XAMPLE_MAP_MIRROR    0x04  // map the data area twice
+
+// hugetlbfs mount tried for XAMPLE_MAP_HUGE when name is a plain shm name
+#define XAMPLE_HUGETLBFS "/dev/hugepages"
+
+typedef struct {
+    volatile uint64_t seq;          // end sample number of frame, 0=busy
+    volatile uint64_t mono;         // CLOCK_MONOTONIC in ns
+    volatile uint64_t real;         // CLOCK_REALTIME in ns
+} xample_time_t;
+
+#define XAMPLE_CLOCK_MONOTONIC 0
+#define XAMPLE_CLOCK_REALTIME  1
+
 #define UPPER_LIMIT_EXCEEDED                0x01
 #define BELOW_LOWER_LIMIT                   0x02
 #define CHANGED_BY_MORE_THAN_DELTA          0x04
@@ -72,8 +218,11 @@ typedef struct {
 #define LIMIT_BITS 0x03
 #define DELTA_BITS 0x1C
 
+#define TRIGGER_ANY_CHANNEL (-1)
+
 typedef struct {
     unsigned char mask;
+    long          channel;          // channel or TRIGGER_ANY_CHANNEL
     unsigned long upper_limit;
     unsigned long lower_limit;
     unsigned long delta;
@@ -81,13 +230,329 @@ typedef struct {
     unsigned long positive_delta;
 } trigger_t;    
 
-// create data stream 
+static inline int eval_trigger(sample_t v, sample_t v0, trigger_t* t)
+{
+    unsigned char m = t->mask;
+    unsigned char r = 0;
+
+    if (m & LIMIT_BITS) {
+	if ((m & UPPER_LIMIT_EXCEEDED)  && (v > t->upper_limit))
+	    r |= UPPER_LIMIT_EXCEEDED;
+	if ((m & BELOW_LOWER_LIMIT) && (v <= t->lower_limit))
+	    r |= BELOW_LOWER_LIMIT;
+    }
+    if (m & DELTA_BITS) {
+	if (v > v0) {
+	    unsigned long d = v - v0;
+	    if ((m & CHANGED_BY_MORE_THAN_DELTA) && (d > t->delta))
+		r |= CHANGED_BY_MORE_THAN_DELTA;
+	    if ((m & CHANGED_BY_MORE_THAN_POSITIVE_DELTA) 
+		&& (d > t->positive_delta))
+		r |= CHANGED_BY_MORE_THAN_POSITIVE_DELTA;
+	}
+	else if (v < v0) {
+	    unsigned long d = v0 - v;
+	    if ((m & CHANGED_BY_MORE_THAN_DELTA) && (d > t->delta))
+		r |= CHANGED_BY_MORE_THAN_DELTA;
+	    if ((m & CHANGED_BY_MORE_THAN_NEGATIVE_DELTA)
+		&& (d > t->negative_delta))
+		r |= CHANGED_BY_MORE_THAN_NEGATIVE_DELTA;
+	}
+    }
+    return r;
+}
+
+// merge t into acc, the result fire when either t or acc fire
+extern void xample_trigger_merge(trigger_t* acc, trigger_t* t);
+
+// per lane thresholds for interleaved channels, the pattern repeats
+// every period samples (period is a multiple of the vector width)
+#define TRIGGER_SCAN_PERIOD_MAX 112   // lcm(7,16)
+
+typedef struct {
+    size_t   nchan;
+    size_t   period;
+    unsigned always;      // channels that fire on any sample
+    uint16_t upper[2*TRIGGER_SCAN_PERIOD_MAX];
+    uint16_t lower1[2*TRIGGER_SCAN_PERIOD_MAX];
+    uint16_t delta[2*TRIGGER_SCAN_PERIOD_MAX];
+    uint16_t negative_delta[2*TRIGGER_SCAN_PERIOD_MAX];
+    uint16_t positive_delta[2*TRIGGER_SCAN_PERIOD_MAX];
+} trigger_scan_t;
+
+// select trigger scan kernel "auto", "scalar", "sse2" or "avx2"
+extern int xample_trigger_kernel(char* name);
+
+// setup scan for nchan interleaved channels, t[j] is the trigger for
+// channel j, limit bits set in m0[j] are already active and ignored
+extern int xample_trigger_compile(trigger_scan_t* ts, trigger_t* t,
+				  unsigned char* m0, size_t nchan);
+
+// return index of first sample in vec[0..n) where a trigger fire,
+// vec[0] is from channel chan0 and prev[0..nchan) are the nchan samples
+// before vec[0]. return n if no sample trigger
+extern size_t xample_trigger_scan(trigger_scan_t* ts, const sample_t* vec,
+				  size_t n, const sample_t* prev,
+				  size_t chan0);
+
+// compiled trigger expressions (see xample_expr.c for the syntax)
+typedef struct _trigger_expr_t trigger_expr_t;
+
+// parse expression, return NULL on syntax error
+extern trigger_expr_t* xample_trigger_expr_parse(char* text);
+extern char* xample_trigger_expr_text(trigger_expr_t* e);
+extern void xample_trigger_expr_free(trigger_expr_t* e);
+
+// compile for nchan interleaved channels, rate is used for holdoff
+extern int xample_trigger_expr_compile(trigger_expr_t* e, size_t nchan,
+				       double rate);
+// do not fire until the expression has been false (after a stop)
+extern void xample_trigger_expr_rearm(trigger_expr_t* e);
+
+// return index of first sample in vec[0..n) where the expression fire,
+// vec[0] is sample number seq, prev[0..nchan) are the nchan samples
+// before vec[0]. state (hysteresis, holdoff ..) is kept as long as the
+// next call continue with the sample after the returned index
+extern size_t xample_trigger_expr_scan(trigger_expr_t* e,
+				       const sample_t* vec, size_t n,
+				       const sample_t* prev, uint64_t seq);
+
+// lossless stream codec (see xample_codec.c for the format), rate is
+// 24.8 fixed point like xample_t.rate: (rate>>8) + (rate&0xff)/256.0 Hz
+#define XAMPLE_CODEC_VERSION  1
+#define XAMPLE_FILE_HEADER    16
+#define XAMPLE_BLOCK_HEADER   24
+#define XAMPLE_BLOCK_STEPS    4096   // default time steps per block
+
+typedef struct _xample_enc_t xample_enc_t;
+
+// write file header at offset and start encoding blocks after it
+extern xample_enc_t* xample_enc_open(int fd, off_t offset, size_t nchan,
+				     uint32_t rate, size_t block_steps);
+// add n interleaved samples, full blocks are written
+extern int xample_enc_write(xample_enc_t* enc, const sample_t* vec, size_t n);
+// drop everything written after the file header
+extern void xample_enc_rewind(xample_enc_t* enc);
+// write last block, free encoder, return offset after last block
+extern off_t xample_enc_close(xample_enc_t* enc);
+
+// parse file header, return header size or -1
+extern int xample_dec_header(const uint8_t* buf, size_t len, size_t* nchan,
+			     uint32_t* rate, size_t* block_steps);
+// parse block header, return block size or -1
+extern ssize_t xample_dec_block_info(const uint8_t* buf, size_t len,
+				     uint64_t* first, size_t* steps);
+// decode block into interleaved out, return number of samples or -1
+extern ssize_t xample_dec_block(const uint8_t* buf, size_t len, size_t nchan,
+				size_t max_steps, sample_t* out);
+
+// log segment files (see xample_segment.c)
+typedef struct _xample_seg_t xample_seg_t;
+
+// scan dirname for segments, max_bytes/max_age 0 means no limit
+extern xample_seg_t* xample_seg_open(char* dirname, uint64_t max_bytes,
+				     double max_age);
+// expire segments over budget and open a new segment named by ts,
+// return fd (name is set to the path) or -1
+extern int xample_seg_create(xample_seg_t* sp, struct timespec* ts,
+			     char* ext, uint64_t prealloc,
+			     char* name, size_t len);
+// expire segments over budget while the open segment fd grows, its
+// allocated size is counted
+extern void xample_seg_check(xample_seg_t* sp, int fd);
+// add a closed segment to the budget
+extern void xample_seg_done(xample_seg_t* sp, char* name);
+extern void xample_seg_stat(xample_seg_t* sp, size_t* nseg, uint64_t* bytes,
+			    unsigned long* recycled, unsigned long* removed);
+extern void xample_seg_close(xample_seg_t* sp);
+
+// single writer counter update (no locked instruction)
+static inline void xample_stat_add(volatile uint64_t* c, uint64_t v)
+{
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + v,
+		     __ATOMIC_RELAXED);
+}
+
+static inline void xample_stat_max(volatile uint64_t* c, uint64_t v)
+{
+    if (v > __atomic_load_n(c, __ATOMIC_RELAXED))
+	__atomic_store_n(c, v, __ATOMIC_RELAXED);
+}
+
+static inline void xample_stat_hist(volatile uint64_t* h, uint64_t v)
+{
+    int k = v ? 64 - __builtin_clzll(v) : 0;
+    xample_stat_add(&h[(k < XAMPLE_STAT_BUCKETS) ? k :
+		       XAMPLE_STAT_BUCKETS-1], 1);
+}
+
+// time a device read took (producer)
+extern void xample_stat_read(xample_stat_t* st, uint64_t ns);
+// reader side, several readers may add
+extern void xample_stat_overrun(xample_t* xp, uint64_t lost);
+
+// sample pacing (producer, see xample_pace.c)
+typedef struct {
+    int64_t  t0;          // schedule start (CLOCK_MONOTONIC ns)
+    double   period;      // ns per tick
+    uint64_t ticks;       // ticks since t0
+    long     busy_ns;     // spin this long before each deadline
+    unsigned long resync; // schedule restarts
+    // lateness stats (ns) since last reset
+    unsigned long n;
+    double   sum;
+    double   sum2;
+    int64_t  min;
+    int64_t  max;
+    xample_stat_t* stat;  // shared counters or NULL, set after init
+} xample_pace_t;
+
+extern void xample_pace_init(xample_pace_t* p, double tick_hz, long busy_ns);
+// advance schedule n ticks and wait for the deadline
+extern void xample_pace_wait(xample_pace_t* p, size_t n);
+extern void xample_pace_reset_stat(xample_pace_t* p);
+extern void xample_pace_print(xample_pace_t* p);
+// CLOCK_MONOTONIC in ns
+extern uint64_t xample_pace_clock(void);
+// SCHED_FIFO priority (> 0), pin to cpu (>= 0), mlockall (lock != 0)
+extern int xample_rt_setup(int prio, int cpu, int lock);
+
+// spi acquisition engine (MCP3202, linux, see xample_spi.c)
+typedef struct _xample_spi_t xample_spi_t;
+
+// fd < 0 use a mock spidev, batch is rounded up to whole time steps
+extern xample_spi_t* xample_spi_start(int fd, uint32_t speed, int* selector,
+				      size_t nchan, size_t batch, size_t nbuf,
+				      xample_pace_t* pace);
+// blocking read of n samples, continuous from channel 0
+extern size_t xample_spi_read(xample_spi_t* sp, sample_t* samples, size_t n);
+extern void xample_spi_stat(xample_spi_t* sp, unsigned long* batches,
+			    unsigned long* stalls, unsigned long* errors);
+// copy the engine pacing stats (pace is copied at start, the engine
+// waits on its own schedule), reset them when reset != 0
+extern void xample_spi_pace(xample_spi_t* sp, xample_pace_t* p, int reset);
+extern void xample_spi_stop(xample_spi_t* sp);
+
+// signal simulator (see xample_sim.c), rate is per channel
+typedef struct _xample_sim_t xample_sim_t;
+
+extern xample_sim_t* xample_sim_new(size_t nchan, double rate, uint64_t seed);
+// set generator of channel c from spec, -1 = bad spec
+extern int xample_sim_config(xample_sim_t* sp, size_t c, char* spec);
+// restart all generators (same output as after new and config)
+extern void xample_sim_reset(xample_sim_t* sp);
+// n interleaved samples, continuous from channel 0
+extern void xample_sim_fill(xample_sim_t* sp, sample_t* samples, size_t n);
+extern void xample_sim_free(xample_sim_t* sp);
+
+// create data stream, name is a shm name or a file path (hugetlbfs),
+// data is in format (use xample_pack unless XAMPLE_FMT_U16)
 extern xample_t* xample_create(char* name, size_t nsamples, size_t fdivpow2,
-			       size_t nchannels,
-			       double rate, mode_t mode, sample_t** data);
-// open data stream for read
-extern xample_t* xample_open(char* name, sample_t** data);
+			       size_t nchannels, int format,
+			       double rate, mode_t mode, int flags,
+			       sample_t** data);
+// open data stream for read, flags XAMPLE_MAP_MIRROR/POPULATE
+extern xample_t* xample_open(char* name, int flags, sample_t** data);
 
 extern int xample_close(xample_t* xp);
 
+// sample formats, bits per sample (0 = unknown format)
+extern int xample_format_bits(int format);
+extern int xample_format_parse(char* name);  // -1 = unknown
+extern const char* xample_format_name(int format);
+// store n samples at sample index i of data
+extern void xample_pack(int format, const sample_t* src, size_t n,
+			void* data, size_t i);
+// load n samples from sample index i of data
+extern void xample_unpack(int format, const void* data, size_t i, size_t n,
+			  sample_t* dst);
+
+// MCP3202 spi responses (3 bytes each) to samples, see xample_format.c
+// kernel NULL or "auto", "scalar", "ssse3" or "neon", -1 = unavailable
+extern int xample_mcp3202_kernel(char* name);
+extern void xample_mcp3202_decode(const uint8_t* rx, size_t n, sample_t* dst);
+// deinterleave, sample i to dst[i % nchan][i / nchan]
+extern void xample_mcp3202_decode_planar(const uint8_t* rx, size_t n,
+					 size_t nchan, sample_t** dst);
+
+// publish write sequence (producer only)
+extern void xample_publish(xample_t* xp, uint64_t seq);
+
+// register a reader cursor from sample seq, flags XAMPLE_READER_xxx,
+// return the slot or -1 when all slots are taken
+extern int xample_reader_register(xample_t* xp, int flags, uint64_t seq);
+// samples before seq are no longer needed, also the heartbeat
+extern void xample_reader_update(xample_t* xp, int slot, uint64_t seq);
+extern void xample_reader_release(xample_t* xp, int slot);
+// scan the cursors (producer), update reader_lag and reader_count,
+// return the read_seq of the slowest live critical reader or seq
+// when there is none
+extern uint64_t xample_reader_scan(xample_t* xp, uint64_t seq);
+
+// time in ns of sample seq (XAMPLE_CLOCK_xxx), interpolated between
+// frame times, extrapolated with the nominal rate outside the table.
+// return 0 or -1 when no frame time is available
+extern int xample_time(xample_t* xp, uint64_t seq, int clock, uint64_t* ns);
+
+// sample number at time ns (XAMPLE_CLOCK_xxx), return 0 or -1
+extern int xample_time_seq(xample_t* xp, uint64_t ns, int clock,
+			   uint64_t* seq);
+
+// wait until write sequence != last_seq, timeout in milliseconds
+// (-1 = wait forever), return 1 if new data, 0 on timeout, -1 on error
+extern int xample_wait(xample_t* xp, uint64_t last_seq, int timeout);
+
+// read the write sequence, retry while the producer is updating
+static inline uint64_t xample_seq(xample_t* xp)
+{
+    uint32_t s0, s1;
+    uint64_t seq;
+
+    do {
+	while((s0 = __atomic_load_n(&xp->seq_lock, __ATOMIC_ACQUIRE)) & 1)
+	    ;
+	seq = xp->write_seq;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	s1 = __atomic_load_n(&xp->seq_lock, __ATOMIC_RELAXED);
+    } while(s0 != s1);
+    return seq;
+}
+
+// get the window [start, end) of samples that may be read,
+// the frame that is being written is not part of the window
+static inline void xample_window(xample_t* xp, uint64_t* start, uint64_t* end)
+{
+    uint64_t seq = xample_seq(xp);
+    uint64_t n = xp->ring_samples - xp->samples_per_frame;
+
+    *start = (seq > n) ? seq - n : 0;
+    *end   = seq;
+}
+
+// validated read: call after the samples [seq, seq+n) have been
+// consumed (copied, scanned, written), return the number of samples
+// from seq that the producer may have overwritten meanwhile, those
+// are always a prefix of the range. 0 = the data read is intact.
+static inline uint64_t xample_check(xample_t* xp, uint64_t seq, uint64_t n)
+{
+    uint64_t start, end;
+
+    // data loads before the sequence load (seqlock reader side)
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    xample_window(xp, &start, &end);
+    if (start <= seq)
+	return 0;
+    return ((start < seq + n) ? start : seq + n) - seq;
+}
+
+// offset in data area of sample number seq
+static inline unsigned long xample_offset(xample_t* xp, uint64_t seq)
+{
+    return (unsigned long) (seq % xp->ring_samples);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
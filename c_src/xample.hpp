@@ -0,0 +1,310 @@
+//
+// C++17 reader interface, header only (link with xample_mem.c and
+// xample_format.c, packed segment formats are read with xample_unpack)
+//
+//   xample::segment seg("/xample");
+//   xample::reader<sample_t, 2> rd(seg);
+//   while(true) {
+//       auto v = rd.next();          // wait for new data
+//       for (auto x : v.channel(1))  // every second sample
+//           ...
+//   }
+//
+// The segment is opened with a mirrored ring (XAMPLE_MAP_MIRROR) when
+// possible, so each view is all new data in one contiguous range.
+// Views are whole time steps (channels samples), starting on channel 0.
+// With a compile time channel count the channel stride is a constant.
+//
+#ifndef __XAMPLE_HPP__
+#define __XAMPLE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "xample.h"
+
+namespace xample {
+
+inline constexpr std::size_t dynamic_channels = 0;
+
+// segment handle, closed on destruction
+class segment {
+public:
+    explicit segment(const std::string& name, int flags = XAMPLE_MAP_MIRROR)
+    {
+	char* cname = const_cast<char*>(name.c_str());
+
+	m_mirrored = (flags & XAMPLE_MAP_MIRROR) != 0;
+	m_xp = xample_open(cname, flags, &m_data);
+	if ((m_xp == nullptr) && m_mirrored) {
+	    m_mirrored = false;
+	    m_xp = xample_open(cname, flags & ~XAMPLE_MAP_MIRROR, &m_data);
+	}
+	if (m_xp == nullptr)
+	    throw std::runtime_error("xample: unable to open " + name);
+    }
+    segment(const segment&) = delete;
+    segment& operator=(const segment&) = delete;
+    segment(segment&& other) noexcept
+	: m_xp(other.m_xp), m_data(other.m_data), m_mirrored(other.m_mirrored)
+    {
+	other.m_xp = nullptr;
+    }
+    segment& operator=(segment&& other) noexcept
+    {
+	if (this != &other) {
+	    close();
+	    m_xp = other.m_xp;
+	    m_data = other.m_data;
+	    m_mirrored = other.m_mirrored;
+	    other.m_xp = nullptr;
+	}
+	return *this;
+    }
+    ~segment() { close(); }
+
+    xample_t* get() const { return m_xp; }
+    const sample_t* data() const { return m_data; }
+    bool mirrored() const { return m_mirrored; }
+    std::size_t channels() const { return m_xp->channels; }
+    int format() const { return int(m_xp->format); }
+    std::size_t ring_samples() const { return m_xp->ring_samples; }
+    double rate() const { return (m_xp->rate >> 8) + (m_xp->rate & 0xff)/256.0; }
+    // contiguous samples from data()
+    std::size_t span() const
+    {
+	return m_mirrored ? 2*m_xp->ring_samples : m_xp->ring_samples;
+    }
+    std::uint64_t seq() const { return xample_seq(m_xp); }
+    void window(std::uint64_t& start, std::uint64_t& end) const
+    {
+	xample_window(m_xp, &start, &end);
+    }
+    // wait for seq != last_seq, timeout in ms (-1 = forever)
+    bool wait(std::uint64_t last_seq, int timeout = -1) const
+    {
+	return xample_wait(m_xp, last_seq, timeout) > 0;
+    }
+    // sample seq (and later) not overwritten yet
+    bool intact(std::uint64_t seq) const
+    {
+	std::uint64_t start, end;
+	window(start, end);
+	return seq >= start;
+    }
+private:
+    void close()
+    {
+	if (m_xp != nullptr)
+	    xample_close(m_xp);
+	m_xp = nullptr;
+    }
+    xample_t* m_xp = nullptr;
+    sample_t* m_data = nullptr;
+    bool m_mirrored = false;
+};
+
+namespace detail {
+    // channel stride, a constant when the channel count is known
+    template <std::size_t N>
+    struct stride {
+	constexpr explicit stride(std::size_t) {}
+	static constexpr std::size_t value() { return N; }
+    };
+    template <>
+    struct stride<dynamic_channels> {
+	constexpr explicit stride(std::size_t n) : m_n(n) {}
+	constexpr std::size_t value() const { return m_n; }
+	std::size_t m_n;
+    };
+}
+
+// iterator over one channel of interleaved samples
+template <typename T, std::size_t Channels = dynamic_channels>
+class channel_iterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::remove_const_t<T>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+
+    constexpr channel_iterator(T* p, std::size_t nchan) : m_p(p), m_s(nchan) {}
+
+    reference operator*() const { return *m_p; }
+    reference operator[](difference_type i) const { return m_p[i*step()]; }
+    channel_iterator& operator++() { m_p += step(); return *this; }
+    channel_iterator operator++(int) { auto t = *this; ++*this; return t; }
+    channel_iterator& operator--() { m_p -= step(); return *this; }
+    channel_iterator operator--(int) { auto t = *this; --*this; return t; }
+    channel_iterator& operator+=(difference_type n) { m_p += n*step(); return *this; }
+    channel_iterator& operator-=(difference_type n) { m_p -= n*step(); return *this; }
+    channel_iterator operator+(difference_type n) const { auto t = *this; return t += n; }
+    channel_iterator operator-(difference_type n) const { auto t = *this; return t -= n; }
+    difference_type operator-(const channel_iterator& o) const
+    {
+	return (m_p - o.m_p) / difference_type(step());
+    }
+    bool operator==(const channel_iterator& o) const { return m_p == o.m_p; }
+    bool operator!=(const channel_iterator& o) const { return m_p != o.m_p; }
+    bool operator<(const channel_iterator& o) const { return m_p < o.m_p; }
+    bool operator>(const channel_iterator& o) const { return m_p > o.m_p; }
+    bool operator<=(const channel_iterator& o) const { return m_p <= o.m_p; }
+    bool operator>=(const channel_iterator& o) const { return m_p >= o.m_p; }
+private:
+    std::ptrdiff_t step() const { return std::ptrdiff_t(m_s.value()); }
+    T* m_p;
+    detail::stride<Channels> m_s;
+};
+
+// one channel of a view
+template <typename T, std::size_t Channels = dynamic_channels>
+class channel_range {
+public:
+    using iterator = channel_iterator<T, Channels>;
+
+    constexpr channel_range(T* p, std::size_t steps, std::size_t nchan)
+	: m_p(p), m_steps(steps), m_s(nchan) {}
+
+    iterator begin() const { return iterator(m_p, m_s.value()); }
+    iterator end() const { return iterator(m_p + m_steps*m_s.value(), m_s.value()); }
+    std::size_t size() const { return m_steps; }
+    T& operator[](std::size_t i) const { return m_p[i*m_s.value()]; }
+private:
+    T* m_p;
+    std::size_t m_steps;
+    detail::stride<Channels> m_s;
+};
+
+// contiguous interleaved samples, first sample is seq (channel 0)
+template <typename T, std::size_t Channels = dynamic_channels>
+class view {
+public:
+    using element_type = T;
+    using iterator = T*;
+
+    constexpr view() : m_p(nullptr), m_size(0), m_seq(0), m_s(Channels ? Channels : 1) {}
+    constexpr view(T* p, std::size_t size, std::uint64_t seq, std::size_t nchan)
+	: m_p(p), m_size(size), m_seq(seq), m_s(nchan) {}
+
+    T* data() const { return m_p; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T* begin() const { return m_p; }
+    T* end() const { return m_p + m_size; }
+    T& operator[](std::size_t i) const { return m_p[i]; }
+
+    // sample number of the first sample
+    std::uint64_t seq() const { return m_seq; }
+    std::size_t channels() const { return m_s.value(); }
+    std::size_t steps() const { return m_size / m_s.value(); }
+    // sample of channel c at time step i
+    T& at(std::size_t i, std::size_t c) const { return m_p[i*m_s.value() + c]; }
+    channel_range<T, Channels> channel(std::size_t c) const
+    {
+	return channel_range<T, Channels>(m_p + c, steps(), m_s.value());
+    }
+    // steps [first, first+count)
+    view subview(std::size_t first, std::size_t count) const
+    {
+	return view(m_p + first*m_s.value(), count*m_s.value(),
+		    m_seq + first*m_s.value(), m_s.value());
+    }
+private:
+    T* m_p;
+    std::size_t m_size;
+    std::uint64_t m_seq;
+    detail::stride<Channels> m_s;
+};
+
+// segment sample format of T
+template <typename T> inline constexpr int format_of = -1;
+template <> inline constexpr int format_of<std::uint8_t> = XAMPLE_FMT_U8;
+template <> inline constexpr int format_of<std::uint16_t> = XAMPLE_FMT_U16;
+template <> inline constexpr int format_of<std::uint32_t> = XAMPLE_FMT_U32;
+template <> inline constexpr int format_of<float> = XAMPLE_FMT_F32;
+
+// follow the write sequence of a segment and return the new data,
+// T is the segment sample type (packed formats are not supported)
+template <typename T = sample_t, std::size_t Channels = dynamic_channels>
+class reader {
+    static_assert(format_of<T> >= 0, "no sample format for T");
+    static_assert(Channels <= XAMPLE_MAX_CHANNELS, "too many channels");
+public:
+    using view_type = view<const T, Channels>;
+
+    // start at the current write sequence
+    explicit reader(const segment& seg) : m_seg(seg)
+    {
+	if ((Channels != dynamic_channels) && (seg.channels() != Channels))
+	    throw std::runtime_error("xample: channel count mismatch");
+	if (seg.format() != format_of<T>)
+	    throw std::runtime_error("xample: sample format mismatch");
+	m_pos = align(seg.seq());
+    }
+
+    // next sample number to return
+    std::uint64_t pos() const { return m_pos; }
+    void seek(std::uint64_t seq) { m_pos = align(seq); }
+    // samples skipped since the producer overwrote them
+    std::uint64_t lost() const { return m_lost; }
+
+    // new data, waits up to timeout ms (-1 = forever), empty on timeout.
+    // the view is valid until the producer laps it, see segment::intact
+    view_type next(int timeout = -1)
+    {
+	std::size_t nchan = m_seg.channels();
+	std::uint64_t start, end;
+
+	m_seg.window(start, end);
+	while(end < m_pos + nchan) {
+	    if (!m_seg.wait(end, timeout))
+		return view_type();
+	    m_seg.window(start, end);
+	}
+	if (m_pos < start) {  // overrun
+	    std::uint64_t next = align(start + nchan - 1);
+	    m_lost += next - m_pos;
+	    m_pos = next;
+	}
+	std::size_t offset = xample_offset(m_seg.get(), m_pos);
+	std::size_t n = ((end - m_pos) / nchan)*nchan;
+	if (n > m_seg.span() - offset) {
+	    n = ((m_seg.span() - offset) / nchan)*nchan;
+	    if (n == 0)
+		return straddle(offset, nchan);
+	}
+	view_type v(reinterpret_cast<const T*>(m_seg.data()) + offset, n,
+		    m_pos, nchan);
+	m_pos += n;
+	return v;
+    }
+private:
+    std::uint64_t align(std::uint64_t seq) const
+    {
+	return seq - (seq % m_seg.channels());
+    }
+    // a time step across the wrap of a ring that is not mirrored
+    view_type straddle(std::size_t offset, std::size_t nchan)
+    {
+	const T* data = reinterpret_cast<const T*>(m_seg.data());
+	std::size_t ring = m_seg.ring_samples();
+	for (std::size_t i = 0; i < nchan; i++)
+	    m_step[i] = data[(offset + i) % ring];
+	view_type v(m_step, nchan, m_pos, nchan);
+	m_pos += nchan;
+	return v;
+    }
+    const segment& m_seg;
+    std::uint64_t m_pos = 0;
+    std::uint64_t m_lost = 0;
+    T m_step[XAMPLE_MAX_CHANNELS];
+};
+
+}  // namespace xample
+
+#endif
@@ -0,0 +1,444 @@
+//
+// Xample lossless stream codec
+//
+// File:   "XAMC" <version:16> <channels:16> <rate:32> <block_steps:32>
+// Block:  "XBLK" <size:32> <first:64> <steps:32> <reserved:32> <bits>
+//
+// rate is the per channel sample rate in 24.8 fixed point as in the
+// segment, (rate>>8) + (rate&0xff)/256.0 Hz.
+//
+// All header fields are little endian, size is the total block size in
+// bytes (header included) and first is the number of samples (all
+// channels) before the block in the stream, so a reader can seek by
+// stepping over block headers. Blocks are independent.
+//
+// The bits (msb first) hold each channel in order:
+//   <shift:4> <order:2> <k:5> <warmup:16>*order <residual>*(steps-order)
+//
+// shift is the number of trailing zero bits common to all samples in
+// the block (4 for 12 bit SPI samples), order is the predictor:
+//   0: x   1: x - x'   2: x - (2x' - x'')
+// residuals are zigzag mapped and Rice coded with parameter k,
+// quotients >= RICE_ESCAPE are sent as RICE_ESCAPE ones followed by
+// the raw value in 20 bits.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+
+#include "xample.h"
+
+#define RICE_ESCAPE    24
+#define RICE_RAW_BITS  20
+#define CHAN_BITS      (4+2+5)
+
+struct _xample_enc_t {
+    int       fd;
+    off_t     data_offs;     // first block offset
+    off_t     offset;        // next block offset
+    size_t    nchan;
+    size_t    block_steps;
+    uint64_t  first;         // samples in the written blocks
+    size_t    fill;          // samples in blk
+    sample_t* blk;           // interleaved block samples
+    int32_t*  x;             // one channel, shifted
+    uint8_t*  out;           // encoded block
+};
+
+typedef struct {
+    uint8_t* ptr;
+    uint64_t acc;
+    int      nbits;   // bits in acc
+} bit_writer_t;
+
+static inline void put_bits(bit_writer_t* bw, uint32_t v, int n)
+{
+    bw->acc = (bw->acc << n) | v;
+    bw->nbits += n;
+    if (bw->nbits >= 32) {
+	uint32_t w = htobe32((uint32_t)(bw->acc >> (bw->nbits - 32)));
+	memcpy(bw->ptr, &w, 4);
+	bw->ptr += 4;
+	bw->nbits -= 32;
+    }
+}
+
+static inline void put_rice(bit_writer_t* bw, uint32_t u, int k)
+{
+    uint32_t q = u >> k;
+
+    if (q < RICE_ESCAPE) {
+	put_bits(bw, (1 << (q+1)) - 2, q+1);
+	if (k)
+	    put_bits(bw, u & ((1 << k) - 1), k);
+    }
+    else {
+	put_bits(bw, (1 << RICE_ESCAPE) - 1, RICE_ESCAPE);
+	put_bits(bw, u, RICE_RAW_BITS);
+    }
+}
+
+static void flush_bits(bit_writer_t* bw)
+{
+    while(bw->nbits > 0) {
+	int n = (bw->nbits >= 8) ? 8 : bw->nbits;
+	*bw->ptr++ = (uint8_t)(bw->acc >> (bw->nbits - n)) << (8 - n);
+	bw->nbits -= n;
+    }
+}
+
+static inline uint32_t zigzag(int32_t r)
+{
+    return ((uint32_t) r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static void put_le32(uint8_t* ptr, uint32_t v)
+{
+    v = htole32(v);
+    memcpy(ptr, &v, 4);
+}
+
+static void put_le64(uint8_t* ptr, uint64_t v)
+{
+    v = htole64(v);
+    memcpy(ptr, &v, 8);
+}
+
+static uint32_t get_le32(const uint8_t* ptr)
+{
+    uint32_t v;
+    memcpy(&v, ptr, 4);
+    return le32toh(v);
+}
+
+static uint64_t get_le64(const uint8_t* ptr)
+{
+    uint64_t v;
+    memcpy(&v, ptr, 8);
+    return le64toh(v);
+}
+
+static int enc_pwrite(int fd, uint8_t* ptr, size_t n, off_t offset)
+{
+    while(n > 0) {
+	ssize_t r = pwrite(fd, ptr, n, offset);
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	ptr += r;
+	n -= r;
+	offset += r;
+    }
+    return 0;
+}
+
+// encode one channel of the block
+static void enc_channel(xample_enc_t* enc, bit_writer_t* bw, size_t c,
+			size_t steps)
+{
+    int32_t* x = enc->x;
+    uint64_t sum[3] = {0, 0, 0};
+    unsigned bits = 0;
+    int shift = 0, order = 0, k = 0;
+    size_t i;
+
+    for (i = 0; i < steps; i++)
+	bits |= enc->blk[i*enc->nchan + c];
+    if (bits) {
+	while(!(bits & 1) && (shift < 15)) {
+	    bits >>= 1;
+	    shift++;
+	}
+    }
+    for (i = 0; i < steps; i++)
+	x[i] = enc->blk[i*enc->nchan + c] >> shift;
+
+    // pick the predictor with the smallest residual sum
+    for (i = 2; i < steps; i++) {
+	int32_t d1 = x[i] - x[i-1];
+	int32_t d2 = d1 - (x[i-1] - x[i-2]);
+	sum[0] += zigzag(x[i]);
+	sum[1] += zigzag(d1);
+	sum[2] += zigzag(d2);
+    }
+    if (steps > 2) {
+	order = (sum[1] < sum[0]) ? 1 : 0;
+	if (sum[2] < sum[order]) order = 2;
+	while((k < RICE_RAW_BITS-1) && (((uint64_t)(steps-2) << (k+1)) <= sum[order]))
+	    k++;
+    }
+    else
+	order = steps;
+
+    put_bits(bw, (shift << 7) | (order << 5) | k, CHAN_BITS);
+    for (i = 0; i < order; i++)
+	put_bits(bw, x[i], 16);
+    switch(order) {
+    case 0:
+	for (i = 0; i < steps; i++)
+	    put_rice(bw, zigzag(x[i]), k);
+	break;
+    case 1:
+	for (i = 1; i < steps; i++)
+	    put_rice(bw, zigzag(x[i] - x[i-1]), k);
+	break;
+    default:
+	for (i = 2; i < steps; i++)
+	    put_rice(bw, zigzag(x[i] - 2*x[i-1] + x[i-2]), k);
+	break;
+    }
+}
+
+// encode and write the whole time steps in blk
+static int enc_flush(xample_enc_t* enc)
+{
+    size_t steps = enc->fill / enc->nchan;
+    bit_writer_t bw;
+    size_t c, size;
+
+    if (steps == 0)
+	return 0;
+    bw.ptr = enc->out + XAMPLE_BLOCK_HEADER;
+    bw.acc = 0;
+    bw.nbits = 0;
+    for (c = 0; c < enc->nchan; c++)
+	enc_channel(enc, &bw, c, steps);
+    flush_bits(&bw);
+    size = bw.ptr - enc->out;
+
+    memcpy(enc->out, "XBLK", 4);
+    put_le32(enc->out+4, size);
+    put_le64(enc->out+8, enc->first);
+    put_le32(enc->out+16, steps);
+    put_le32(enc->out+20, 0);
+    if (enc_pwrite(enc->fd, enc->out, size, enc->offset) < 0)
+	return -1;
+    enc->offset += size;
+    enc->first  += steps*enc->nchan;
+    // keep a partial time step for the next block
+    memmove(enc->blk, enc->blk + steps*enc->nchan,
+	    (enc->fill - steps*enc->nchan)*sizeof(sample_t));
+    enc->fill -= steps*enc->nchan;
+    return 0;
+}
+
+xample_enc_t* xample_enc_open(int fd, off_t offset, size_t nchan,
+			      uint32_t rate, size_t block_steps)
+{
+    xample_enc_t* enc;
+    uint8_t hdr[XAMPLE_FILE_HEADER];
+    uint16_t v;
+
+    if ((nchan < 1) || (nchan > XAMPLE_MAX_CHANNELS) || (block_steps < 1)) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if ((enc = calloc(1, sizeof(xample_enc_t))) == NULL)
+	return NULL;
+    enc->fd = fd;
+    enc->nchan = nchan;
+    enc->block_steps = block_steps;
+    enc->blk = malloc(block_steps*nchan*sizeof(sample_t));
+    enc->x   = malloc(block_steps*sizeof(int32_t));
+    // worst case is every residual escaped
+    enc->out = malloc(XAMPLE_BLOCK_HEADER + 8 +
+		      nchan*(4 + 2*2 + block_steps*(RICE_ESCAPE+RICE_RAW_BITS+7)/8));
+    if (!enc->blk || !enc->x || !enc->out) {
+	xample_enc_close(enc);
+	return NULL;
+    }
+    memcpy(hdr, "XAMC", 4);
+    v = htole16(XAMPLE_CODEC_VERSION); memcpy(hdr+4, &v, 2);
+    v = htole16(nchan); memcpy(hdr+6, &v, 2);
+    put_le32(hdr+8, rate);
+    put_le32(hdr+12, block_steps);
+    if (enc_pwrite(fd, hdr, sizeof(hdr), offset) < 0) {
+	int err = errno;
+	xample_enc_close(enc);
+	errno = err;
+	return NULL;
+    }
+    enc->data_offs = enc->offset = offset + sizeof(hdr);
+    return enc;
+}
+
+int xample_enc_write(xample_enc_t* enc, const sample_t* vec, size_t n)
+{
+    size_t cap = enc->block_steps*enc->nchan;
+
+    while(n > 0) {
+	size_t m = cap - enc->fill;
+	if (m > n) m = n;
+	memcpy(enc->blk + enc->fill, vec, m*sizeof(sample_t));
+	enc->fill += m;
+	vec += m;
+	n -= m;
+	if ((enc->fill == cap) && (enc_flush(enc) < 0))
+	    return -1;
+    }
+    return 0;
+}
+
+void xample_enc_rewind(xample_enc_t* enc)
+{
+    enc->offset = enc->data_offs;
+    enc->first = 0;
+    enc->fill = 0;
+}
+
+off_t xample_enc_close(xample_enc_t* enc)
+{
+    off_t end;
+
+    if (enc->fd >= 0) {
+	if (enc->blk && enc->x && enc->out)
+	    enc_flush(enc);  // a trailing partial time step is dropped
+    }
+    end = enc->offset;
+    free(enc->blk);
+    free(enc->x);
+    free(enc->out);
+    free(enc);
+    return end;
+}
+
+// Decoder
+
+typedef struct {
+    const uint8_t* ptr;
+    const uint8_t* end;
+    uint64_t acc;
+    int      nbits;   // valid bits in acc (msb aligned)
+} bit_reader_t;
+
+static inline void refill(bit_reader_t* br)
+{
+    while((br->nbits <= 56) && (br->ptr < br->end)) {
+	br->acc |= (uint64_t)(*br->ptr++) << (56 - br->nbits);
+	br->nbits += 8;
+    }
+}
+
+static inline uint32_t get_bits(bit_reader_t* br, int n)
+{
+    uint32_t v;
+
+    if (n == 0)
+	return 0;
+    if (br->nbits < n)
+	refill(br);
+    v = (uint32_t)(br->acc >> (64 - n));
+    br->acc <<= n;
+    br->nbits -= n;
+    return v;
+}
+
+static inline uint32_t get_rice(bit_reader_t* br, int k)
+{
+    uint32_t q;
+
+    if (br->nbits < 32)
+	refill(br);
+    q = (~br->acc == 0) ? 64 : __builtin_clzll(~br->acc);
+    if (q >= RICE_ESCAPE) {
+	get_bits(br, RICE_ESCAPE);
+	return get_bits(br, RICE_RAW_BITS);
+    }
+    br->acc <<= (q+1);
+    br->nbits -= (q+1);
+    return (q << k) | get_bits(br, k);
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+    return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+int xample_dec_header(const uint8_t* buf, size_t len, size_t* nchan,
+		      uint32_t* rate, size_t* block_steps)
+{
+    uint16_t v;
+
+    if ((len < XAMPLE_FILE_HEADER) || (memcmp(buf, "XAMC", 4) != 0))
+	return -1;
+    memcpy(&v, buf+4, 2);
+    if (le16toh(v) != XAMPLE_CODEC_VERSION)
+	return -1;
+    memcpy(&v, buf+6, 2);
+    *nchan = le16toh(v);
+    *rate = get_le32(buf+8);
+    *block_steps = get_le32(buf+12);
+    if ((*nchan < 1) || (*nchan > XAMPLE_MAX_CHANNELS) || (*block_steps < 1))
+	return -1;
+    return XAMPLE_FILE_HEADER;
+}
+
+ssize_t xample_dec_block_info(const uint8_t* buf, size_t len,
+			      uint64_t* first, size_t* steps)
+{
+    size_t size;
+
+    if ((len < XAMPLE_BLOCK_HEADER) || (memcmp(buf, "XBLK", 4) != 0))
+	return -1;
+    size = get_le32(buf+4);
+    if ((size < XAMPLE_BLOCK_HEADER) || (size > len))
+	return -1;
+    *first = get_le64(buf+8);
+    *steps = get_le32(buf+16);
+    return size;
+}
+
+ssize_t xample_dec_block(const uint8_t* buf, size_t len, size_t nchan,
+			 size_t max_steps, sample_t* out)
+{
+    bit_reader_t br;
+    uint64_t first;
+    size_t steps, c, i;
+    ssize_t size;
+
+    if ((size = xample_dec_block_info(buf, len, &first, &steps)) < 0)
+	return -1;
+    if (steps > max_steps)
+	return -1;
+    br.ptr = buf + XAMPLE_BLOCK_HEADER;
+    br.end = buf + size;
+    br.acc = 0;
+    br.nbits = 0;
+    for (c = 0; c < nchan; c++) {
+	uint32_t h = get_bits(&br, CHAN_BITS);
+	int shift = h >> 7;
+	int order = (h >> 5) & 3;
+	int k = h & 31;
+	sample_t* y = out + c;
+	int32_t x1 = 0, x2 = 0, x;
+
+	if ((order > 2) || (order > steps) || (k >= RICE_RAW_BITS))
+	    return -1;
+	for (i = 0; i < order; i++) {
+	    x = get_bits(&br, 16);
+	    y[i*nchan] = x << shift;
+	    x2 = x1;
+	    x1 = x;
+	}
+	for (; i < steps; i++) {
+	    int32_t r = unzigzag(get_rice(&br, k));
+	    switch(order) {
+	    case 0: x = r; break;
+	    case 1: x = x1 + r; break;
+	    default: x = 2*x1 - x2 + r; break;
+	    }
+	    y[i*nchan] = x << shift;
+	    x2 = x1;
+	    x1 = x;
+	}
+	if ((br.ptr == br.end) && (br.nbits < 0))
+	    return -1;
+    }
+    return steps*nchan;
+}
@@ -0,0 +1,746 @@
+//
+// Compiled trigger expressions
+//
+// expr    := and { '|' and }
+// and     := unary { '&' unary }
+// unary   := '!' unary | '(' expr ')' { ':' qual } | cond
+// cond    := item { ':' item }       items in a cond are or:ed
+// item    := 'c' ':' <num>           channel (default any channel)
+//          | 'u' ':' <num>           above upper limit
+//          | 'l' ':' <num>           below (or at) lower limit
+//          | 'w' ':' <lo> ':' <hi>   inside band lo..hi
+//          | 'o' ':' <lo> ':' <hi>   outside band lo..hi
+//          | 'd' ':' <num>           changed by more than delta
+//          | 'p' ':' <num>           raised by more than delta
+//          | 'n' ':' <num>           fell by more than delta
+//          | 'h' ':' <num>           hysteresis for u,l,w,o in the cond
+//          | qual
+// qual    := 'N' ':' <num>           must hold for num samples in a row
+//          | 'H' ':' <ms>            holdoff time after trigger
+//
+// The expression is evaluated once per time step, that is one sample
+// from every channel. A cond without channel is evaluated on every
+// channel and the results or:ed.
+//
+// The parse tree is compiled into a postfix program of kernels, each
+// kernel process a block of time steps into a mask vector (16 bits
+// per step), so there is no per sample dispatch on the expression.
+// Input is deinterleaved into per channel blocks first.
+// Kernels with state (hysteresis, N in a row) are plain loops, the
+// state is saved before each block and replayed up to the trigger
+// point, so the next scan continue from the sample after the trigger.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xample.h"
+
+#define EXPR_BLOCK      256   // time steps per block
+#define EXPR_VEC        8     // steps per vector
+#define EXPR_MAX_NODES  64
+#define EXPR_MAX_INST   128
+#define EXPR_MAX_SLOTS  32
+
+#define EXPR_BAND    1   // (lo <= x <= hi) ^ inv (u,l,w,o)
+#define EXPR_DELTA   2   // |x - x'| > lo
+#define EXPR_PDELTA  3   // x - x' > lo
+#define EXPR_NDELTA  4   // x' - x > lo
+#define EXPR_AND     5
+#define EXPR_OR      6
+#define EXPR_NOT     7
+#define EXPR_COUNT   8   // l hold for n steps
+
+typedef struct _expr_node_t {
+    int op;
+    long chan;
+    long lo, hi;        // band or delta
+    long h;             // hysteresis
+    int  inv;           // band is inverted
+    unsigned long n;    // count
+    struct _expr_node_t* l;
+    struct _expr_node_t* r;
+} expr_node_t;
+
+typedef struct _expr_inst_t expr_inst_t;
+typedef void (*expr_fn_t)(trigger_expr_t* e, expr_inst_t* p,
+			  size_t k0, size_t k1);
+
+struct _expr_inst_t {
+    expr_fn_t fn;
+    int      chan;
+    uint16_t lo, hi;     // set band (empty when lo > hi)
+    uint16_t hlo, hhi;   // hold band (hysteresis)
+    uint16_t inv;
+    unsigned long n;
+    int      dst;        // result mask slot
+    int      src;        // second operand slot
+    int      state;      // state slot
+};
+
+struct _trigger_expr_t {
+    char*        text;
+    expr_node_t  node[EXPR_MAX_NODES];
+    int          nnodes;
+    expr_node_t* root;
+    unsigned long holdoff_ms;
+
+    // compiled
+    size_t       nchan;
+    expr_inst_t  inst[EXPR_MAX_INST];
+    int          ninst;
+    int          nstate;
+    uint64_t     holdoff;       // in samples
+    uint64_t     holdoff_until; // no trigger before this sample
+    int          rearm;         // wait for a false step before trigger
+    unsigned long state[EXPR_MAX_INST];
+    unsigned long saved[EXPR_MAX_INST];
+
+    // input, x[c][0] is the previous step, step k is at x[c][k+1]
+    uint64_t     next_seq;      // expected seq in next scan
+    int          valid;         // next_seq is valid
+    size_t       c;             // channel of next sample
+    size_t       k;             // steps in block
+    size_t       k0;            // steps evaluated
+    uint64_t     seq0;          // seq of last sample in step 0
+    sample_t     x[XAMPLE_MAX_CHANNELS][EXPR_BLOCK+EXPR_VEC];
+    uint16_t     mask[EXPR_MAX_SLOTS][EXPR_BLOCK];
+};
+
+// Kernels
+//
+// Stateless kernels use vector extensions, they round the step range
+// out to whole vectors, the extra mask lanes are never looked at.
+
+typedef uint16_t vu16_t __attribute__((vector_size(2*EXPR_VEC)));
+
+static inline vu16_t vload(const uint16_t* p)
+{
+    vu16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void vstore(uint16_t* p, vu16_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline vu16_t vdup(uint16_t a)
+{
+    return (vu16_t){0} + a;
+}
+
+#define VRANGE(k, k0, k1) \
+    for ((k) = (k0) & ~(size_t)(EXPR_VEC-1); (k) < (k1); (k) += EXPR_VEC)
+
+static void k_band(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    const sample_t* x = e->x[p->chan] + 1;
+    uint16_t* m = e->mask[p->dst];
+    vu16_t lo = vdup(p->lo), hi = vdup(p->hi), inv = vdup(-p->inv);
+    size_t k;
+
+    VRANGE(k, k0, k1) {
+	vu16_t v = vload(x+k);
+	vstore(m+k, ((vu16_t)((v >= lo) & (v <= hi))) ^ inv);
+    }
+}
+
+// hysteresis: set when x in set band, stay set while x in hold band
+static void k_band_h(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    const sample_t* x = e->x[p->chan] + 1;
+    uint16_t* m = e->mask[p->dst];
+    uint16_t lo = p->lo, hi = p->hi, hlo = p->hlo, hhi = p->hhi;
+    uint16_t inv = p->inv;
+    unsigned long st = e->state[p->state];
+    size_t k;
+
+    for (k = k0; k < k1; k++) {
+	unsigned long set  = ((x[k] >= lo) & (x[k] <= hi)) ^ inv;
+	unsigned long hold = ((x[k] >= hlo) & (x[k] <= hhi)) ^ inv;
+	st = set | (st & hold);
+	m[k] = -(uint16_t) st;
+    }
+    e->state[p->state] = st;
+}
+
+static void k_delta(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    const sample_t* x = e->x[p->chan] + 1;
+    uint16_t* m = e->mask[p->dst];
+    vu16_t lo = vdup(p->lo);
+    size_t k;
+
+    VRANGE(k, k0, k1) {
+	vu16_t v = vload(x+k), v1 = vload(x+k-1);
+	vstore(m+k, (vu16_t)(((v > v1) & ((v - v1) > lo)) |
+			     ((v1 > v) & ((v1 - v) > lo))));
+    }
+}
+
+static void k_pdelta(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    const sample_t* x = e->x[p->chan] + 1;
+    uint16_t* m = e->mask[p->dst];
+    vu16_t lo = vdup(p->lo);
+    size_t k;
+
+    VRANGE(k, k0, k1) {
+	vu16_t v = vload(x+k), v1 = vload(x+k-1);
+	vstore(m+k, (vu16_t)((v > v1) & ((v - v1) > lo)));
+    }
+}
+
+static void k_ndelta(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    const sample_t* x = e->x[p->chan] + 1;
+    uint16_t* m = e->mask[p->dst];
+    vu16_t lo = vdup(p->lo);
+    size_t k;
+
+    VRANGE(k, k0, k1) {
+	vu16_t v = vload(x+k), v1 = vload(x+k-1);
+	vstore(m+k, (vu16_t)((v1 > v) & ((v1 - v) > lo)));
+    }
+}
+
+static void k_and(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    uint16_t* m = e->mask[p->dst];
+    uint16_t* s = e->mask[p->src];
+    size_t k;
+
+    VRANGE(k, k0, k1)
+	vstore(m+k, vload(m+k) & vload(s+k));
+}
+
+static void k_or(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    uint16_t* m = e->mask[p->dst];
+    uint16_t* s = e->mask[p->src];
+    size_t k;
+
+    VRANGE(k, k0, k1)
+	vstore(m+k, vload(m+k) | vload(s+k));
+}
+
+static void k_not(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    uint16_t* m = e->mask[p->dst];
+    size_t k;
+
+    VRANGE(k, k0, k1)
+	vstore(m+k, ~vload(m+k));
+}
+
+static void k_count(trigger_expr_t* e, expr_inst_t* p, size_t k0, size_t k1)
+{
+    uint16_t* m = e->mask[p->dst];
+    unsigned long run = e->state[p->state];
+    unsigned long n = p->n;
+    size_t k;
+
+    for (k = k0; k < k1; k++) {
+	run = (run + (run < n)) & -(unsigned long)(m[k] & 1);
+	m[k] = -(uint16_t)(run >= n);
+    }
+    e->state[p->state] = run;
+}
+
+// first step in k..k1 with a non zero mask
+static size_t find_first(uint16_t* m, size_t k, size_t k1)
+{
+    while((k < k1) && ((k & (EXPR_VEC-1)) != 0) && !m[k])
+	k++;
+    if ((k < k1) && !m[k]) {
+	vu16_t zero = vdup(0);
+	// whole vectors (the mask array is padded to whole vectors)
+	while(k < k1) {
+	    vu16_t v = vload(m+k);
+	    if (memcmp(&v, &zero, sizeof(v)) != 0)
+		break;
+	    k += EXPR_VEC;
+	}
+	while((k < k1) && !m[k])
+	    k++;
+    }
+    return (k < k1) ? k : k1;
+}
+
+// first step in k..k1 with a zero mask
+static size_t find_zero(uint16_t* m, size_t k, size_t k1)
+{
+    while((k < k1) && m[k])
+	k++;
+    return k;
+}
+
+// Parser
+
+static int parse_num(char** pp, long* val)
+{
+    char* ptr = *pp;
+    long v = 0;
+
+    if ((*ptr < '0') || (*ptr > '9'))
+	return -1;
+    while((*ptr >= '0') && (*ptr <= '9')) {
+	v = v*10 + (*ptr - '0');
+	ptr++;
+    }
+    *val = v;
+    *pp = ptr;
+    return 0;
+}
+
+// parse "<key>:<num>" (and ":<num>" for bands), key is at **pp
+static int parse_item(char** pp, int* key, long* a, long* b)
+{
+    char* ptr = *pp;
+
+    if ((*key = *ptr++) == '\0')
+	return -1;
+    if (*ptr++ != ':')
+	return -1;
+    if (parse_num(&ptr, a) < 0)
+	return -1;
+    if ((*key == 'w') || (*key == 'o')) {
+	if (*ptr++ != ':')
+	    return -1;
+	if ((parse_num(&ptr, b) < 0) || (*b < *a))
+	    return -1;
+    }
+    *pp = ptr;
+    return 0;
+}
+
+static expr_node_t* new_node(trigger_expr_t* e, int op,
+			     expr_node_t* l, expr_node_t* r)
+{
+    expr_node_t* np;
+
+    if (e->nnodes >= EXPR_MAX_NODES)
+	return NULL;
+    np = &e->node[e->nnodes++];
+    memset(np, 0, sizeof(expr_node_t));
+    np->op = op;
+    np->chan = TRIGGER_ANY_CHANNEL;
+    np->l = l;
+    np->r = r;
+    return np;
+}
+
+static expr_node_t* parse_expr(trigger_expr_t* e, char** pp);
+
+// parse qualifiers (N, H) following a cond or a parenthesized expr
+static expr_node_t* parse_qual(trigger_expr_t* e, char** pp,
+			       expr_node_t* np, int key, long a)
+{
+    if (key == 'N') {
+	if (a == 0)
+	    return np;
+	np = new_node(e, EXPR_COUNT, np, NULL);
+	if (np) np->n = a;
+	return np;
+    }
+    if (key == 'H') {
+	if ((unsigned long) a > e->holdoff_ms)
+	    e->holdoff_ms = a;
+	return np;
+    }
+    return NULL;
+}
+
+static expr_node_t* parse_cond(trigger_expr_t* e, char** pp)
+{
+    expr_node_t* item[EXPR_MAX_NODES];
+    expr_node_t* np = NULL;
+    long chan = TRIGGER_ANY_CHANNEL;
+    long h = 0;
+    long count = 0;
+    int  i, n = 0;
+
+    while(1) {
+	expr_node_t* ip = NULL;
+	int  key;
+	long a, b = 0;
+
+	if (parse_item(pp, &key, &a, &b) < 0)
+	    return NULL;
+	switch(key) {
+	case 'c': chan = a; break;
+	case 'h': h = a; break;
+	case 'N': count = a; break;
+	case 'H': parse_qual(e, pp, NULL, key, a); break;
+	case 'u':
+	    if ((ip = new_node(e, EXPR_BAND, NULL, NULL)) == NULL)
+		return NULL;
+	    ip->lo = a+1; ip->hi = 0xffff;
+	    break;
+	case 'l':
+	    if ((ip = new_node(e, EXPR_BAND, NULL, NULL)) == NULL)
+		return NULL;
+	    ip->lo = 0; ip->hi = a;
+	    break;
+	case 'w':
+	case 'o':
+	    if ((ip = new_node(e, EXPR_BAND, NULL, NULL)) == NULL)
+		return NULL;
+	    ip->lo = a; ip->hi = b;
+	    ip->inv = (key == 'o');
+	    break;
+	case 'd':
+	case 'p':
+	case 'n':
+	    if ((ip = new_node(e, (key == 'd') ? EXPR_DELTA :
+			       ((key == 'p') ? EXPR_PDELTA : EXPR_NDELTA),
+			       NULL, NULL)) == NULL)
+		return NULL;
+	    ip->lo = a;
+	    break;
+	default:
+	    return NULL;
+	}
+	if (ip)
+	    item[n++] = ip;
+	if (**pp != ':')
+	    break;
+	(*pp)++;
+    }
+    for (i = 0; i < n; i++) {
+	item[i]->chan = chan;
+	item[i]->h = (item[i]->op == EXPR_BAND) ? h : 0;
+	if (np == NULL)
+	    np = item[i];
+	else if ((np = new_node(e, EXPR_OR, np, item[i])) == NULL)
+	    return NULL;
+    }
+    if (np == NULL)  // only c,h,N or H
+	return NULL;
+    return parse_qual(e, pp, np, 'N', count);
+}
+
+static expr_node_t* parse_unary(trigger_expr_t* e, char** pp)
+{
+    expr_node_t* np;
+
+    if (**pp == '!') {
+	(*pp)++;
+	if ((np = parse_unary(e, pp)) == NULL)
+	    return NULL;
+	return new_node(e, EXPR_NOT, np, NULL);
+    }
+    if (**pp == '(') {
+	(*pp)++;
+	if ((np = parse_expr(e, pp)) == NULL)
+	    return NULL;
+	if (**pp != ')')
+	    return NULL;
+	(*pp)++;
+	while(**pp == ':') {
+	    int key;
+	    long a, b;
+	    (*pp)++;
+	    if (parse_item(pp, &key, &a, &b) < 0)
+		return NULL;
+	    if ((np = parse_qual(e, pp, np, key, a)) == NULL)
+		return NULL;
+	}
+	return np;
+    }
+    return parse_cond(e, pp);
+}
+
+static expr_node_t* parse_and(trigger_expr_t* e, char** pp)
+{
+    expr_node_t* np;
+
+    if ((np = parse_unary(e, pp)) == NULL)
+	return NULL;
+    while(**pp == '&') {
+	expr_node_t* rp;
+	(*pp)++;
+	if ((rp = parse_unary(e, pp)) == NULL)
+	    return NULL;
+	if ((np = new_node(e, EXPR_AND, np, rp)) == NULL)
+	    return NULL;
+    }
+    return np;
+}
+
+static expr_node_t* parse_expr(trigger_expr_t* e, char** pp)
+{
+    expr_node_t* np;
+
+    if ((np = parse_and(e, pp)) == NULL)
+	return NULL;
+    while(**pp == '|') {
+	expr_node_t* rp;
+	(*pp)++;
+	if ((rp = parse_and(e, pp)) == NULL)
+	    return NULL;
+	if ((np = new_node(e, EXPR_OR, np, rp)) == NULL)
+	    return NULL;
+    }
+    return np;
+}
+
+trigger_expr_t* xample_trigger_expr_parse(char* text)
+{
+    trigger_expr_t* e;
+    char* ptr = text;
+
+    if ((e = calloc(1, sizeof(trigger_expr_t))) == NULL)
+	return NULL;
+    if (((e->root = parse_expr(e, &ptr)) == NULL) || (*ptr != '\0')) {
+	free(e);
+	return NULL;
+    }
+    e->text = strdup(text);
+    return e;
+}
+
+char* xample_trigger_expr_text(trigger_expr_t* e)
+{
+    return e->text;
+}
+
+void xample_trigger_expr_free(trigger_expr_t* e)
+{
+    if (e) {
+	free(e->text);
+	free(e);
+    }
+}
+
+// Compiler
+
+static expr_inst_t* emit(trigger_expr_t* e, expr_fn_t fn, int dst, int src)
+{
+    expr_inst_t* p;
+
+    if ((e->ninst >= EXPR_MAX_INST) || (dst >= EXPR_MAX_SLOTS) ||
+	(src >= EXPR_MAX_SLOTS))
+	return NULL;
+    p = &e->inst[e->ninst++];
+    memset(p, 0, sizeof(expr_inst_t));
+    p->fn  = fn;
+    p->dst = dst;
+    p->src = src;
+    p->state = e->nstate;
+    return p;
+}
+
+// set a 16 bit band, an empty band is lo=1,hi=0
+static void band16(uint16_t* lo, uint16_t* hi, long a, long b)
+{
+    if (a < 0) a = 0;
+    if (b > 0xffff) b = 0xffff;
+    if (a > b) {
+	a = 1;
+	b = 0;
+    }
+    *lo = a;
+    *hi = b;
+}
+
+static int compile_leaf(trigger_expr_t* e, expr_node_t* np, int chan, int sp)
+{
+    expr_inst_t* p;
+    expr_fn_t fn;
+
+    switch(np->op) {
+    case EXPR_BAND:   fn = (np->h > 0) ? k_band_h : k_band; break;
+    case EXPR_DELTA:  fn = k_delta; break;
+    case EXPR_PDELTA: fn = k_pdelta; break;
+    case EXPR_NDELTA: fn = k_ndelta; break;
+    default: return -1;
+    }
+    if ((p = emit(e, fn, sp, sp)) == NULL)
+	return -1;
+    p->chan = chan;
+    p->inv  = np->inv;
+    if (np->op == EXPR_BAND)
+	band16(&p->lo, &p->hi, np->lo, np->hi);
+    else
+	p->lo = (np->lo > 0xffff) ? 0xffff : np->lo;
+    if (fn == k_band_h) {
+	// outside band: hold while outside the narrowed band
+	if (np->inv)
+	    band16(&p->hlo, &p->hhi, np->lo + np->h, np->hi - np->h);
+	else
+	    band16(&p->hlo, &p->hhi, np->lo - np->h, np->hi + np->h);
+	e->nstate++;
+    }
+    return 0;
+}
+
+static int compile_node(trigger_expr_t* e, expr_node_t* np, int sp)
+{
+    expr_inst_t* p;
+    int c;
+
+    switch(np->op) {
+    case EXPR_AND:
+    case EXPR_OR:
+	if ((compile_node(e, np->l, sp) < 0) ||
+	    (compile_node(e, np->r, sp+1) < 0))
+	    return -1;
+	return emit(e, (np->op == EXPR_AND) ? k_and : k_or, sp, sp+1) ?
+	    0 : -1;
+    case EXPR_NOT:
+	if (compile_node(e, np->l, sp) < 0)
+	    return -1;
+	return emit(e, k_not, sp, sp) ? 0 : -1;
+    case EXPR_COUNT:
+	if (compile_node(e, np->l, sp) < 0)
+	    return -1;
+	if ((p = emit(e, k_count, sp, sp)) == NULL)
+	    return -1;
+	p->n = np->n;
+	e->nstate++;
+	return 0;
+    default:
+	if (np->chan != TRIGGER_ANY_CHANNEL) {
+	    if ((np->chan < 0) || (np->chan >= e->nchan))
+		return -1;
+	    return compile_leaf(e, np, np->chan, sp);
+	}
+	// or the leaf over all channels
+	for (c = 0; c < e->nchan; c++) {
+	    if (compile_leaf(e, np, c, sp + (c > 0)) < 0)
+		return -1;
+	    if ((c > 0) && (emit(e, k_or, sp, sp+1) == NULL))
+		return -1;
+	}
+	return 0;
+    }
+}
+
+int xample_trigger_expr_compile(trigger_expr_t* e, size_t nchan, double rate)
+{
+    if ((nchan < 1) || (nchan > XAMPLE_MAX_CHANNELS))
+	return -1;
+    e->nchan  = nchan;
+    e->ninst  = 0;
+    e->nstate = 0;
+    if (compile_node(e, e->root, 0) < 0)
+	return -1;
+    e->holdoff = (uint64_t) ((e->holdoff_ms * rate) / 1000.0) * nchan;
+    e->holdoff_until = 0;
+    e->rearm = 0;
+    e->valid = 0;
+    return 0;
+}
+
+void xample_trigger_expr_rearm(trigger_expr_t* e)
+{
+    e->rearm = 1;
+}
+
+// Evaluation
+
+// restart with the nchan samples in prev before sample seq
+static void expr_restart(trigger_expr_t* e, const sample_t* prev, uint64_t seq)
+{
+    size_t nchan = e->nchan;
+    size_t chan0 = seq % nchan;
+    size_t c;
+
+    memset(e->state, 0, sizeof(e->state));
+    // prev[j] is sample seq-nchan+j, from channel (chan0+j) % nchan
+    for (c = 0; c < nchan; c++) {
+	if (c < chan0) {
+	    e->x[c][1] = prev[nchan + c - chan0];
+	    e->x[c][0] = e->x[c][1];
+	}
+	else
+	    e->x[c][0] = prev[c - chan0];
+    }
+    e->c  = chan0;
+    e->k  = 0;
+    e->k0 = 0;
+    e->seq0 = seq + (nchan - 1 - chan0);
+    e->valid = 1;
+}
+
+size_t xample_trigger_expr_scan(trigger_expr_t* e, const sample_t* vec,
+				size_t n, const sample_t* prev, uint64_t seq)
+{
+    size_t nchan = e->nchan;
+    size_t i = 0;
+
+    if (!e->valid || (e->next_seq != seq))
+	expr_restart(e, prev, seq);
+
+    while(i < n) {
+	size_t k0, k1, k, c, ip;
+
+	// deinterleave into the block
+	if ((nchan == 1) && (e->k < EXPR_BLOCK)) {
+	    size_t m = EXPR_BLOCK - e->k;
+	    if (m > n - i) m = n - i;
+	    memcpy(&e->x[0][e->k+1], vec+i, m*sizeof(sample_t));
+	    e->k += m;
+	    i += m;
+	}
+	else {
+	    size_t ck = e->k, cc = e->c;
+	    while((i < n) && (ck < EXPR_BLOCK)) {
+		e->x[cc][ck+1] = vec[i++];
+		if (++cc == nchan) {
+		    cc = 0;
+		    ck++;
+		}
+	    }
+	    e->k = ck;
+	    e->c = cc;
+	}
+	// run program on the new complete steps
+	k0 = e->k0;
+	k1 = e->k;
+	if (k1 > k0) {
+	    memcpy(e->saved, e->state, e->nstate*sizeof(unsigned long));
+	    for (ip = 0; ip < e->ninst; ip++)
+		e->inst[ip].fn(e, &e->inst[ip], k0, k1);
+	    k = k0;
+	    if (e->holdoff_until > e->seq0 + k0*nchan) {
+		k = (e->holdoff_until - e->seq0 + nchan - 1) / nchan;
+		if (k > k1) k = k1;
+	    }
+	    if (e->rearm) {
+		// like the level triggers, a condition still true from
+		// the last stop must go false before it can fire again
+		k = find_zero(e->mask[0], k, k1);
+		if (k < k1)
+		    e->rearm = 0;
+	    }
+	    k = find_first(e->mask[0], k, k1);
+	    if (k < k1) {
+		// trigger, replay state up to step k and drop the rest
+		uint64_t tseq = e->seq0 + k*nchan;
+		memcpy(e->state, e->saved, e->nstate*sizeof(unsigned long));
+		for (ip = 0; ip < e->ninst; ip++)
+		    e->inst[ip].fn(e, &e->inst[ip], k0, k+1);
+		e->k  = e->k0 = k+1;
+		e->c  = 0;
+		e->holdoff_until = tseq + e->holdoff;
+		e->next_seq = tseq + 1;
+		return tseq - seq;
+	    }
+	    e->k0 = k1;
+	}
+	if (e->k == EXPR_BLOCK) {
+	    // block is full (no partial step), keep last step as previous
+	    for (c = 0; c < nchan; c++)
+		e->x[c][0] = e->x[c][EXPR_BLOCK];
+	    e->k = e->k0 = 0;
+	    e->seq0 += EXPR_BLOCK*nchan;
+	}
+    }
+    e->next_seq = seq + n;
+    return n;
+}
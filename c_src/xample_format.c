@@ -0,0 +1,465 @@
+//
+// Sample formats in the shared memory ring
+//
+// Producers and consumers work on 16 bit samples (sample_t, MSB
+// aligned, offset binary), the kernels here convert to and from the
+// segment format. Data is addressed by sample index, the caller
+// handle the ring wrap (or use a mirrored mapping).
+//
+// The MCP3202 decode kernels (xample_mcp3202_*) convert the 3 byte SPI
+// responses to samples: 12 bit result in the low nibble of byte 1 and
+// byte 2, scaled to 16 bit.
+//
+// XAMPLE_FMT_U12P packs two samples in three bytes, little endian:
+//   byte 0 = a[7:0], byte 1 = b[3:0] a[11:8], byte 2 = b[11:4]
+// A sample with odd index starts in the middle of byte 1, so packing
+// a range that begin or end on an odd index merge with the neighbour.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FORMAT_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#define FORMAT_NEON
+#include <arm_neon.h>
+#endif
+
+// 8 samples at a time, gcc vector extensions (as xample_expr.c)
+#define FMT_VEC 8
+typedef uint16_t vu16_t __attribute__((vector_size(2*FMT_VEC)));
+typedef uint8_t  vu8_t  __attribute__((vector_size(FMT_VEC)));
+typedef uint32_t vu32_t __attribute__((vector_size(4*FMT_VEC)));
+typedef int32_t  vi32_t __attribute__((vector_size(4*FMT_VEC)));
+typedef float    vf32_t __attribute__((vector_size(4*FMT_VEC)));
+typedef float    vf4_t  __attribute__((vector_size(16)));
+typedef int32_t  vi4_t  __attribute__((vector_size(16)));
+typedef uint16_t vu16x4_t __attribute__((vector_size(8)));
+
+static const char* format_names[] = {
+    [XAMPLE_FMT_U16]  = "u16",
+    [XAMPLE_FMT_U8]   = "u8",
+    [XAMPLE_FMT_U12P] = "u12p",
+    [XAMPLE_FMT_U32]  = "u32",
+    [XAMPLE_FMT_F32]  = "f32",
+};
+
+int xample_format_bits(int format)
+{
+    switch(format) {
+    case XAMPLE_FMT_U16:  return 16;
+    case XAMPLE_FMT_U8:   return 8;
+    case XAMPLE_FMT_U12P: return 12;
+    case XAMPLE_FMT_U32:  return 32;
+    case XAMPLE_FMT_F32:  return 32;
+    default: return 0;
+    }
+}
+
+int xample_format_parse(char* name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(format_names)/sizeof(format_names[0]); i++) {
+	if (strcmp(name, format_names[i]) == 0)
+	    return i;
+    }
+    return -1;
+}
+
+const char* xample_format_name(int format)
+{
+    if (xample_format_bits(format) == 0)
+	return "unknown";
+    return format_names[format];
+}
+
+// 12 bit packed, pairs of samples
+
+static inline void pack_pair(uint8_t* p, sample_t a, sample_t b)
+{
+    a >>= 4;
+    b >>= 4;
+    p[0] = a;
+    p[1] = (a >> 8) | (b << 4);
+    p[2] = b >> 4;
+}
+
+static inline void unpack_pair(const uint8_t* p, sample_t* dst)
+{
+    dst[0] = (p[0] | ((p[1] & 0x0f) << 8)) << 4;
+    dst[1] = ((p[1] >> 4) | (p[2] << 4)) << 4;
+}
+
+static size_t pack12_scalar(const sample_t* src, size_t n, uint8_t* p)
+{
+    size_t i;
+
+    for (i = 0; i+1 < n; i += 2, p += 3)
+	pack_pair(p, src[i], src[i+1]);
+    return i;
+}
+
+static size_t unpack12_scalar(const uint8_t* p, size_t n, sample_t* dst)
+{
+    size_t i;
+
+    for (i = 0; i+1 < n; i += 2, p += 3)
+	unpack_pair(p, dst+i);
+    return i;
+}
+
+#if defined(FORMAT_X86)
+// 8 samples <-> 12 bytes, as four 32 bit lanes with a pair each
+__attribute__((target("ssse3")))
+static size_t pack12_ssse3(const sample_t* src, size_t n, uint8_t* p)
+{
+    const __m128i lo = _mm_set1_epi32(0x00000fff);
+    const __m128i hi = _mm_set1_epi32(0x00fff000);
+    const __m128i shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+				       12, 13, 14, -1, -1, -1, -1);
+    size_t i;
+
+    for (i = 0; i+8 <= n; i += 8, p += 12) {
+	__m128i v = _mm_srli_epi16(_mm_loadu_si128((__m128i*)(src+i)), 4);
+	uint32_t w;
+	v = _mm_or_si128(_mm_and_si128(v, lo),
+			 _mm_and_si128(_mm_srli_epi32(v, 4), hi));
+	v = _mm_shuffle_epi8(v, shuf);
+	_mm_storel_epi64((__m128i*) p, v);
+	w = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+	memcpy(p+8, &w, 4);
+    }
+    return i + pack12_scalar(src+i, n-i, p);
+}
+
+__attribute__((target("ssse3")))
+static size_t unpack12_ssse3(const uint8_t* p, size_t n, sample_t* dst)
+{
+    const __m128i lo = _mm_set1_epi32(0x0000fff0);
+    const __m128i hi = _mm_set1_epi32(0xfff00000);
+    const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+				       6, 7, 8, -1, 9, 10, 11, -1);
+    size_t i;
+
+    for (i = 0; i+8 <= n; i += 8, p += 12) {
+	uint32_t w;
+	__m128i v;
+	// no 16 byte load, it may cross the end of the mapping
+	memcpy(&w, p+8, 4);
+	v = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*) p),
+			       _mm_cvtsi32_si128(w));
+	v = _mm_shuffle_epi8(v, shuf);
+	v = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 4), lo),
+			 _mm_and_si128(_mm_slli_epi32(v, 8), hi));
+	_mm_storeu_si128((__m128i*)(dst+i), v);
+    }
+    return i + unpack12_scalar(p, n-i, dst+i);
+}
+#endif
+
+static size_t (*pack12)(const sample_t*, size_t, uint8_t*) = NULL;
+static size_t (*unpack12)(const uint8_t*, size_t, sample_t*) = NULL;
+
+static void select12(void)
+{
+    pack12 = pack12_scalar;
+    unpack12 = unpack12_scalar;
+#if defined(FORMAT_X86)
+    if (__builtin_cpu_supports("ssse3")) {
+	pack12 = pack12_ssse3;
+	unpack12 = unpack12_ssse3;
+    }
+#endif
+}
+
+static void pack_u12p(const sample_t* src, size_t n, uint8_t* data, size_t i)
+{
+    uint8_t* p = data + (i/2)*3;
+    size_t k;
+
+    if (pack12 == NULL)
+	select12();
+    if ((n > 0) && (i & 1)) {  // odd start, high half of a pair
+	sample_t pair[2];
+	unpack_pair(p, pair);
+	pack_pair(p, pair[0], src[0]);
+	src++; n--; p += 3;
+    }
+    k = pack12(src, n, p);
+    if (k < n) {  // odd end, low half of a pair
+	sample_t pair[2];
+	p += (k/2)*3;
+	unpack_pair(p, pair);
+	pack_pair(p, src[k], pair[1]);
+    }
+}
+
+static void unpack_u12p(const uint8_t* data, size_t i, size_t n, sample_t* dst)
+{
+    const uint8_t* p = data + (i/2)*3;
+    sample_t pair[2];
+    size_t k;
+
+    if (unpack12 == NULL)
+	select12();
+    if ((n > 0) && (i & 1)) {
+	unpack_pair(p, pair);
+	*dst++ = pair[1];
+	n--; p += 3;
+    }
+    k = unpack12(p, n, dst);
+    if (k < n) {
+	unpack_pair(p + (k/2)*3, pair);
+	dst[k] = pair[0];
+    }
+}
+
+void xample_pack(int format, const sample_t* restrict src, size_t n,
+		 void* data, size_t i)
+{
+    size_t k;
+
+    switch(format) {
+    case XAMPLE_FMT_U16:
+	memcpy((sample_t*) data + i, src, n*sizeof(sample_t));
+	break;
+    case XAMPLE_FMT_U8: {
+	uint8_t* restrict dst = (uint8_t*) data + i;
+	for (k = 0; k+FMT_VEC <= n; k += FMT_VEC) {
+	    vu16_t v;
+	    vu8_t r;
+	    memcpy(&v, src+k, sizeof(v));
+	    r = __builtin_convertvector(v >> 8, vu8_t);
+	    memcpy(dst+k, &r, sizeof(r));
+	}
+	for (; k < n; k++)
+	    dst[k] = src[k] >> 8;
+	break;
+    }
+    case XAMPLE_FMT_U12P:
+	pack_u12p(src, n, data, i);
+	break;
+    case XAMPLE_FMT_U32: {
+	uint32_t* restrict dst = (uint32_t*) data + i;
+	for (k = 0; k+FMT_VEC <= n; k += FMT_VEC) {
+	    vu16_t v;
+	    vu32_t r;
+	    memcpy(&v, src+k, sizeof(v));
+	    r = __builtin_convertvector(v, vu32_t) << 16;
+	    memcpy(dst+k, &r, sizeof(r));
+	}
+	for (; k < n; k++)
+	    dst[k] = (uint32_t) src[k] << 16;
+	break;
+    }
+    case XAMPLE_FMT_F32: {
+	float* restrict dst = (float*) data + i;
+	for (k = 0; k+FMT_VEC <= n; k += FMT_VEC) {
+	    vu16_t v;
+	    vf32_t r;
+	    memcpy(&v, src+k, sizeof(v));
+	    r = __builtin_convertvector(__builtin_convertvector(v, vi32_t) - 32768,
+					vf32_t) * (1.0f/32768);
+	    memcpy(dst+k, &r, sizeof(r));
+	}
+	for (; k < n; k++)
+	    dst[k] = ((int32_t) src[k] - 32768) * (1.0f/32768);
+	break;
+    }
+    }
+}
+
+void xample_unpack(int format, const void* data, size_t i, size_t n,
+		   sample_t* restrict dst)
+{
+    size_t k;
+
+    switch(format) {
+    case XAMPLE_FMT_U16:
+	memcpy(dst, (const sample_t*) data + i, n*sizeof(sample_t));
+	break;
+    case XAMPLE_FMT_U8: {
+	const uint8_t* restrict src = (const uint8_t*) data + i;
+	for (k = 0; k+FMT_VEC <= n; k += FMT_VEC) {
+	    vu8_t v;
+	    vu16_t r;
+	    memcpy(&v, src+k, sizeof(v));
+	    r = __builtin_convertvector(v, vu16_t) << 8;
+	    memcpy(dst+k, &r, sizeof(r));
+	}
+	for (; k < n; k++)
+	    dst[k] = src[k] << 8;
+	break;
+    }
+    case XAMPLE_FMT_U12P:
+	unpack_u12p(data, i, n, dst);
+	break;
+    case XAMPLE_FMT_U32: {
+	const uint32_t* restrict src = (const uint32_t*) data + i;
+	for (k = 0; k+FMT_VEC <= n; k += FMT_VEC) {
+	    vu32_t v;
+	    vu16_t r;
+	    memcpy(&v, src+k, sizeof(v));
+	    r = __builtin_convertvector(v >> 16, vu16_t);
+	    memcpy(dst+k, &r, sizeof(r));
+	}
+	for (; k < n; k++)
+	    dst[k] = src[k] >> 16;
+	break;
+    }
+    case XAMPLE_FMT_F32: {
+	const float* restrict src = (const float*) data + i;
+	for (k = 0; k+4 <= n; k += 4) {  // 4 lanes, sse2 compares
+	    vf4_t v;
+	    vi4_t x, lt, gt;
+	    vu16x4_t r;
+	    memcpy(&v, src+k, sizeof(v));
+	    v = v*32768 + 32768.5f;
+	    lt = (v < 0);       // clamp to 0 .. 65535 with masks
+	    gt = (v > 65535);
+	    x = __builtin_convertvector(v, vi4_t);
+	    x = (x & ~(lt | gt)) | (gt & 65535);
+	    r = __builtin_convertvector(x, vu16x4_t);
+	    memcpy(dst+k, &r, sizeof(r));
+	}
+	for (; k < n; k++) {
+	    float v = src[k]*32768 + 32768.5f;
+	    v = (v < 0) ? 0 : ((v > 65535) ? 65535 : v);
+	    dst[k] = (sample_t) v;
+	}
+	break;
+    }
+    }
+}
+
+// MCP3202 spi responses
+
+#define MCP3202_BLOCK 256  // samples per planar decode step
+
+static size_t mcp3202_scalar(const uint8_t* rx, size_t n, sample_t* dst)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++, rx += 3)
+	dst[i] = (((rx[1] & 0xf) << 8) + rx[2]) << 4;
+    return n;
+}
+
+#if defined(FORMAT_X86)
+// 8 frames (24 bytes) per step, as loads at byte 0 and 8, the shuffles
+// swap byte 1 and 2 of each frame into a little endian word
+__attribute__((target("ssse3")))
+static size_t mcp3202_ssse3(const uint8_t* rx, size_t n, sample_t* dst)
+{
+    const __m128i mask = _mm_set1_epi16(0x0fff);
+    const __m128i shuf0 = _mm_setr_epi8(2, 1, 5, 4, 8, 7, 11, 10,
+					14, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i shuf1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+					-1, -1, 9, 8, 12, 11, 15, 14);
+    size_t i;
+
+    for (i = 0; i+8 <= n; i += 8, rx += 24) {
+	__m128i a = _mm_loadu_si128((__m128i*) rx);
+	__m128i b = _mm_loadu_si128((__m128i*) (rx+8));
+	__m128i v = _mm_or_si128(_mm_shuffle_epi8(a, shuf0),
+				 _mm_shuffle_epi8(b, shuf1));
+	v = _mm_slli_epi16(_mm_and_si128(v, mask), 4);
+	_mm_storeu_si128((__m128i*)(dst+i), v);
+    }
+    return i + mcp3202_scalar(rx, n-i, dst+i);
+}
+#endif
+
+#if defined(FORMAT_NEON)
+// as ssse3, table lookup index >= 16 give 0
+static size_t mcp3202_neon(const uint8_t* rx, size_t n, sample_t* dst)
+{
+    static const uint8_t tbl0[16] = { 2, 1, 5, 4, 8, 7, 11, 10,
+				      14, 13, 255, 255, 255, 255, 255, 255 };
+    static const uint8_t tbl1[16] = { 255, 255, 255, 255, 255, 255, 255, 255,
+				      255, 255, 9, 8, 12, 11, 15, 14 };
+    const uint8x16_t t0 = vld1q_u8(tbl0);
+    const uint8x16_t t1 = vld1q_u8(tbl1);
+    const uint16x8_t mask = vdupq_n_u16(0x0fff);
+    size_t i;
+
+    for (i = 0; i+8 <= n; i += 8, rx += 24) {
+	uint8x16_t v = vorrq_u8(vqtbl1q_u8(vld1q_u8(rx), t0),
+				vqtbl1q_u8(vld1q_u8(rx+8), t1));
+	uint16x8_t w = vshlq_n_u16(vandq_u16(vreinterpretq_u16_u8(v), mask), 4);
+	vst1q_u16(dst+i, w);
+    }
+    return i + mcp3202_scalar(rx, n-i, dst+i);
+}
+#endif
+
+static size_t (*mcp3202_fn)(const uint8_t*, size_t, sample_t*) = NULL;
+
+int xample_mcp3202_kernel(char* name)
+{
+    if ((name == NULL) || (strcmp(name, "auto") == 0)) {
+	mcp3202_fn = mcp3202_scalar;
+#if defined(FORMAT_X86)
+	if (__builtin_cpu_supports("ssse3"))
+	    mcp3202_fn = mcp3202_ssse3;
+#elif defined(FORMAT_NEON)
+	mcp3202_fn = mcp3202_neon;
+#endif
+	return 0;
+    }
+    if (strcmp(name, "scalar") == 0) {
+	mcp3202_fn = mcp3202_scalar;
+	return 0;
+    }
+#if defined(FORMAT_X86)
+    if ((strcmp(name, "ssse3") == 0) && __builtin_cpu_supports("ssse3")) {
+	mcp3202_fn = mcp3202_ssse3;
+	return 0;
+    }
+#endif
+#if defined(FORMAT_NEON)
+    if (strcmp(name, "neon") == 0) {
+	mcp3202_fn = mcp3202_neon;
+	return 0;
+    }
+#endif
+    return -1;
+}
+
+void xample_mcp3202_decode(const uint8_t* rx, size_t n, sample_t* dst)
+{
+    if (mcp3202_fn == NULL)
+	xample_mcp3202_kernel(NULL);
+    mcp3202_fn(rx, n, dst);
+}
+
+void xample_mcp3202_decode_planar(const uint8_t* rx, size_t n, size_t nchan,
+				  sample_t** dst)
+{
+    sample_t tmp[MCP3202_BLOCK];
+    size_t i, j, c, k;
+
+    if (nchan == 1) {
+	xample_mcp3202_decode(rx, n, dst[0]);
+	return;
+    }
+    // blocks of whole time steps, decoded then scattered
+    k = (MCP3202_BLOCK / nchan)*nchan;
+    for (i = 0; i < n; i += k, rx += 3*k) {
+	size_t m = (n - i < k) ? n - i : k;
+	size_t step = i / nchan;
+	xample_mcp3202_decode(rx, m, tmp);
+	for (c = 0; c < nchan; c++) {
+	    sample_t* d = dst[c] + step;
+	    for (j = c; j < m; j += nchan)
+		*d++ = tmp[j];
+	}
+    }
+}
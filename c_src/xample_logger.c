@@ -9,58 +9,193 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include "xample.h"
 
 #define DEF_MAX_SAMPLES  (1024*1024) // 1M samples
 #define DEF_MAX_TIME     60.0        // one minute of samples per file
+#define MAX_TRIGGERS     16          // max number of -s / -e options
+#define MAX_EXPR_LEN     256         // max length of a trigger expression
+#define DEF_QUEUE_SIZE   256         // writer queue size (requests)
+#define MAX_STALE_RANGES 16          // stale ranges listed per file
 
 typedef struct _wav_file_t {
-    FILE* f;
+    int   fd;
     char* name;
-    size_t num_samples;       // number of samples written
+    size_t num_samples;       // number of samples written (all channels)
     size_t num_channels;      // channels per sample (interleaved)
     size_t bytes_per_sample;  // bytes per sample 
-    long   riff_offs;    // offset (=4) to set RIFF size
-    long   data_offs;    // offset (=40) to set data chunk size
+    off_t  riff_offs;    // offset (=4) to set RIFF size
+    off_t  data_offs;    // offset (=40) to set data chunk size
+    xample_enc_t* enc;   // compressed file (not wav) when set
+    // samples overwritten by the producer before or while written,
+    // at file sample position pos, how is 'z' zeroed, 'd' dropped or
+    // 't' torn (already encoded)
+    uint64_t stale;
+    size_t   nstale;
+    struct { uint64_t pos; uint64_t n; char how; } stale_at[MAX_STALE_RANGES];
+    uint64_t skip;       // samples still to drop (whole time steps)
 } wav_file_t;
 
-size_t file_write_uint16(uint16_t value, wav_file_t* wf)
+static void put_uint16(uint8_t* ptr, uint16_t value)
 {
     value = htole16(value);
-    return fwrite(&value, 1, sizeof(value), wf->f);
+    memcpy(ptr, &value, sizeof(value));
 }
 
-size_t file_write_uint32(uint32_t value, wav_file_t* wf)
+static void put_uint32(uint8_t* ptr, uint32_t value)
 {
     value = htole32(value);
-    return fwrite(&value, 1, sizeof(value), wf->f);
+    memcpy(ptr, &value, sizeof(value));
 }
 
+// write iov (n bytes in total) at offset, restart on partial writes
+static int file_pwritev(int fd, struct iovec* iov, int cnt, size_t n,
+			off_t offset)
+{
+    while(n > 0) {
+	ssize_t r = pwritev(fd, iov, cnt, offset);
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	n -= r;
+	offset += r;
+	while((cnt > 0) && ((size_t) r >= iov->iov_len)) {
+	    r -= iov->iov_len;
+	    iov++;
+	    cnt--;
+	}
+	if (cnt > 0) {
+	    iov->iov_base = (char*) iov->iov_base + r;
+	    iov->iov_len -= r;
+	}
+    }
+    return 0;
+}
+
+// write samples straight from vec[0..n) (no stdio copy) after the
+// samples already written
 size_t file_write_samples(sample_t* vec, size_t n, wav_file_t* wf)
 {
-    size_t r = 0;
+    off_t offset = wf->data_offs + 4 + wf->num_samples*wf->bytes_per_sample;
+    struct iovec iov;
+
+    if (wf->enc) {
+	if (xample_enc_write(wf->enc, vec, n) < 0)
+	    return 0;
+	wf->num_samples += n;
+	return n;
+    }
 #if __BYTE_ORDER == __LITTLE_ENDIAN
-    r = fwrite(vec, n, sizeof(sample_t), wf->f);
+    iov.iov_base = vec;
+    iov.iov_len  = n*sizeof(sample_t);
+    if (file_pwritev(wf->fd, &iov, 1, iov.iov_len, offset) < 0)
+	return 0;
 #else
-    int i;
-    for (i = 0; i < n; i++) {
-	uint16_t value = htole16((uint16_t)vec[i]);
-	r += fwrite(&value, 1, sizeof(value), wf->f);
+    uint16_t buf[1024];
+    size_t i, j;
+    for (i = 0; i < n; i += j) {
+	for (j = 0; (j < 1024) && (i+j < n); j++)
+	    buf[j] = htole16((uint16_t)vec[i+j]);
+	iov.iov_base = buf;
+	iov.iov_len  = j*sizeof(uint16_t);
+	if (file_pwritev(wf->fd, &iov, 1, iov.iov_len, offset) < 0)
+	    return i;
+	offset += iov.iov_len;
     }
 #endif
     wf->num_samples += n;
+    return n;
+}
+
+// write the sample vectors in iov (n samples in total) in one call
+size_t file_write_samplev(struct iovec* iov, int cnt, size_t n, wav_file_t* wf)
+{
+    size_t r = 0;
+    int i;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    if (wf->enc == NULL) {
+	off_t offset = wf->data_offs + 4 +
+	    wf->num_samples*wf->bytes_per_sample;
+	if (file_pwritev(wf->fd, iov, cnt, n*sizeof(sample_t), offset) < 0)
+	    return 0;
+	wf->num_samples += n;
+	return n;
+    }
+#endif
+    for (i = 0; i < cnt; i++)
+	r += file_write_samples(iov[i].iov_base,
+				iov[i].iov_len/sizeof(sample_t), wf);
     return r;
 }
 
+// overwrite n samples at file sample position pos with zeros (wav)
+static int file_zero_samples(wav_file_t* wf, uint64_t pos, size_t n)
+{
+    static sample_t zero[1024];
+    off_t offset = wf->data_offs + 4 + pos*wf->bytes_per_sample;
+
+    while(n > 0) {
+	struct iovec iov;
+	size_t m = (n > 1024) ? 1024 : n;
+	iov.iov_base = zero;
+	iov.iov_len  = m*sizeof(sample_t);
+	if (file_pwritev(wf->fd, &iov, 1, iov.iov_len, offset) < 0)
+	    return -1;
+	offset += iov.iov_len;
+	n -= m;
+    }
+    return 0;
+}
+
+static void file_stale(wav_file_t* wf, uint64_t pos, uint64_t n, char how)
+{
+    wf->stale += n;
+    if (wf->nstale > 0) {
+	size_t i = wf->nstale-1;
+	if ((wf->stale_at[i].pos == pos) && (wf->stale_at[i].how == how)) {
+	    wf->stale_at[i].n += n;  // dropped next to dropped
+	    return;
+	}
+    }
+    if (wf->nstale < MAX_STALE_RANGES) {
+	wf->stale_at[wf->nstale].pos = pos;
+	wf->stale_at[wf->nstale].n = n;
+	wf->stale_at[wf->nstale].how = how;
+	wf->nstale++;
+    }
+}
+
+// stale ranges as text "xample: <n> stale samples: <how>:<pos>+<n> ..."
+static void file_stale_text(wav_file_t* wf, char* buf, size_t len)
+{
+    size_t i, k;
+
+    k = snprintf(buf, len, "xample: %llu stale samples:",
+		 (unsigned long long) wf->stale);
+    for (i = 0; (i < wf->nstale) && (k < len); i++)
+	k += snprintf(buf+k, len-k, " %c:%llu+%llu", wf->stale_at[i].how,
+		      (unsigned long long) wf->stale_at[i].pos,
+		      (unsigned long long) wf->stale_at[i].n);
+    if ((wf->nstale == MAX_STALE_RANGES) && (k < len))
+	snprintf(buf+k, len-k, " ...");
+}
+
 int file_wav_init(wav_file_t* wf, xample_t* xp)
 {
+    uint8_t  hdr[44];
     uint32_t sample_rate;
     uint32_t num_channels;
     uint16_t bytes_per_sample;
-    uint16_t byte_rate;
+    uint32_t byte_rate;
     uint32_t num_samples = 0;  // not known at this point (need patch)
     size_t   size;
+    struct iovec iov;
 
     num_channels = xp->channels;
     bytes_per_sample = 2;
@@ -73,44 +208,52 @@ int file_wav_init(wav_file_t* wf, xample_t* xp)
     wf->num_channels = num_channels;
     wf->bytes_per_sample = 2;
 
-    // write RIFF header
-    fwrite("RIFF", 1, 4, wf->f);
-    wf->riff_offs = ftell(wf->f);
-    file_write_uint32(36 + size, wf);
-    fwrite("WAVE", 1, 4, wf->f);
-    // write fmt  subchunk 
-    fwrite("fmt ", 1, 4, wf->f);
-    file_write_uint32(16, wf);   // SubChunk1Size is 16
-    file_write_uint16(1, wf);    // PCM is format 1
-    file_write_uint16(num_channels, wf);
-    file_write_uint32(sample_rate, wf);
-    file_write_uint32(byte_rate, wf);
+    // RIFF header
+    memcpy(hdr, "RIFF", 4);
+    wf->riff_offs = 4;
+    put_uint32(hdr+4, 36 + size);
+    memcpy(hdr+8, "WAVE", 4);
+    // fmt  subchunk 
+    memcpy(hdr+12, "fmt ", 4);
+    put_uint32(hdr+16, 16);   // SubChunk1Size is 16
+    put_uint16(hdr+20, 1);    // PCM is format 1
+    put_uint16(hdr+22, num_channels);
+    put_uint32(hdr+24, sample_rate);
+    put_uint32(hdr+28, byte_rate);
     // block align
-    file_write_uint16(num_channels*bytes_per_sample, wf);
-    file_write_uint16(8*bytes_per_sample, wf);  /* bits/sample */
-    // write data subchunk
-    fwrite("data", 1, 4, wf->f);
-    wf->data_offs = ftell(wf->f);
-    file_write_uint32(size, wf); 
-    return 0;
+    put_uint16(hdr+32, num_channels*bytes_per_sample);
+    put_uint16(hdr+34, 8*bytes_per_sample);  /* bits/sample */
+    // data subchunk
+    memcpy(hdr+36, "data", 4);
+    wf->data_offs = 40;
+    put_uint32(hdr+40, size);
+    iov.iov_base = hdr;
+    iov.iov_len  = sizeof(hdr);
+    return file_pwritev(wf->fd, &iov, 1, sizeof(hdr), 0);
 }
 
-wav_file_t* file_wav_open(char* name, xample_t* xp)
+// start a file on the open fd, compress selects the xample codec
+// format instead of wav. fd is closed on error.
+wav_file_t* file_wav_open(int fd, char* name, xample_t* xp, int compress)
 {
     wav_file_t* wf;
-    FILE* f;
 
-    if ((f=fopen(name, "w")) == NULL)
-	return NULL;
     if ((wf = (wav_file_t*) calloc(1, sizeof(wav_file_t))) == NULL) {
-	fclose(f);
+	close(fd);
 	return NULL;
     }
-    wf->f = f;
+    wf->fd = fd;
     wf->name = strdup(name);
-    if (file_wav_init(wf, xp) < 0) {
+    if (compress) {
+	wf->num_channels = xp->channels;
+	wf->bytes_per_sample = 2;
+	wf->enc = xample_enc_open(fd, 0, xp->channels, xp->rate,
+				  XAMPLE_BLOCK_STEPS);
+    }
+    if ((compress && (wf->enc == NULL)) ||
+	(!compress && (file_wav_init(wf, xp) < 0))) {
 	int err = errno;
-	fclose(f);
+	close(fd);
 	if (wf->name) free(wf->name);
 	free(wf);
 	errno = err;
@@ -119,31 +262,423 @@ wav_file_t* file_wav_open(char* name, xample_t* xp)
     return wf;
 }
 
+// flag a torn capture in the file, a LIST INFO chunk with an ICMT
+// comment listing the stale ranges, after the data chunk
+static size_t file_wav_flag(wav_file_t* wf, off_t offset)
+{
+    uint8_t hdr[20];
+    char text[512];
+    size_t tlen, clen;
+    struct iovec iov[2];
+
+    file_stale_text(wf, text, sizeof(text));
+    tlen = strlen(text) + 1;
+    clen = (tlen + 1) & ~1;    // chunks are word aligned
+    memcpy(hdr, "LIST", 4);
+    put_uint32(hdr+4, 4 + 8 + clen);
+    memcpy(hdr+8, "INFO", 4);
+    memcpy(hdr+12, "ICMT", 4);
+    put_uint32(hdr+16, tlen);
+    memset(text + tlen, 0, clen - tlen);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = sizeof(hdr);
+    iov[1].iov_base = text;
+    iov[1].iov_len  = clen;
+    if (file_pwritev(wf->fd, iov, 2, sizeof(hdr) + clen, offset) < 0)
+	return 0;
+    return sizeof(hdr) + clen;
+}
+
 void file_wav_close(wav_file_t* wf)
 {
+    uint8_t  buf[4];
     uint32_t size;
+    size_t   extra = 0;
+    struct iovec iov;
 
-    size = wf->bytes_per_sample * wf->num_channels * wf->num_samples;
-
-    fseek(wf->f, wf->riff_offs, SEEK_SET);
-    file_write_uint32(36 + size, wf);
+    if (wf->enc) {
+	if (ftruncate(wf->fd, xample_enc_close(wf->enc)) < 0)
+	    perror("ftruncate");
+	close(wf->fd);
+	if (wf->name) free(wf->name);
+	free(wf);
+	return;
+    }
+    size = wf->bytes_per_sample * wf->num_samples;
+    if (wf->stale > 0)
+	extra = file_wav_flag(wf, wf->data_offs + 4 + size);
 
-    fseek(wf->f, wf->data_offs, SEEK_SET);
-    file_write_uint32(size, wf);
+    iov.iov_base = buf;
+    iov.iov_len  = 4;
+    put_uint32(buf, 36 + size + extra);
+    file_pwritev(wf->fd, &iov, 1, 4, wf->riff_offs);
+    iov.iov_base = buf;
+    iov.iov_len  = 4;
+    put_uint32(buf, size);
+    file_pwritev(wf->fd, &iov, 1, 4, wf->data_offs);
+    // release preallocated blocks not used
+    if (ftruncate(wf->fd, wf->data_offs + 4 + size + extra) < 0)
+	perror("ftruncate");
 
-    fclose(wf->f);
+    close(wf->fd);
     if (wf->name) free(wf->name);
     free(wf);
 }
 
+// Writer thread
+//
+// The scan loop never touch the file, it queue requests to the writer
+// thread. Data requests are references into the shared memory ring
+// (sample number and count), the writer check the producer window
+// before and after each write so samples overwritten before they
+// reached the file are never written (zeros are written instead to
+// keep the file timeline, or with -O drop they are left out) and are
+// counted as stale. A file with stale samples is flagged: the ranges
+// are listed in a LIST/INFO ICMT chunk after the wav data and printed
+// when the file is closed.
+
+#define LOG_OPEN     1   // open segment for time seq (ns), n bytes
+#define LOG_DATA     2   // write n samples from seq
+#define LOG_HISTORY  3   // write n samples from seq, redo if overwritten
+#define LOG_CLOSE    4   // close file and report metrics
+
+typedef struct {
+    int      op;
+    uint64_t seq;
+    size_t   n;
+    char*    name;
+} log_req_t;
+
+typedef struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    log_req_t*      q;
+    size_t          size;        // queue size
+    size_t          head;        // next request to write
+    size_t          count;       // requests in queue
+    xample_t*       xp;
+    sample_t*       ring;
+    size_t          span;        // contiguous samples from ring (mirror)
+    int             compress;    // write xample codec files
+    int             drop;        // drop stale samples instead of zeros
+    xample_seg_t*   seg;         // segment files
+    wav_file_t*     wf;
+    // metrics
+    size_t          max_depth;   // max queue depth
+    unsigned long   full;        // times the scan loop waited on full queue
+    unsigned long   writes;
+    double          lat_sum;     // write latency (seconds)
+    double          lat_max;
+    uint64_t        headroom;    // min samples left before overwrite
+    uint64_t        stale;       // samples overwritten before written
+} log_writer_t;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// write the range [s, e) of the ring to the file, one pwritev
+static void writer_ring(log_writer_t* w, uint64_t s, uint64_t e)
+{
+    struct iovec iov[2];
+    unsigned long offset = xample_offset(w->xp, s);
+    size_t m = w->span - offset;
+    int cnt = 1;
+
+    if (m > e - s)
+	m = e - s;
+    iov[0].iov_base = w->ring + offset;
+    iov[0].iov_len  = m*sizeof(sample_t);
+    if (m < e - s) {
+	iov[1].iov_base = w->ring;
+	iov[1].iov_len  = (e - s - m)*sizeof(sample_t);
+	cnt = 2;
+    }
+    if (file_write_samplev(iov, cnt, e - s, w->wf) == 0)
+	perror("write");
+}
+
+// samples to drop from s for k stale samples, whole time steps so
+// the file stays interleaved from channel 0
+static uint64_t writer_drop(log_writer_t* w, uint64_t s, uint64_t e,
+			    uint64_t k)
+{
+    size_t nchan = w->wf->num_channels;
+
+    k = ((k + nchan - 1) / nchan)*nchan;
+    if (k > e - s) {
+	w->wf->skip = k - (e - s);
+	k = e - s;
+    }
+    return k;
+}
+
+// write n samples from seq. Samples overwritten before the write are
+// zeroed (or dropped), the window is checked again after the write
+// and samples overwritten during it are zeroed in the file (or dropped
+// and the rest written again). Compressed files can only be flagged
+// once encoded. Return number of stale samples.
+static uint64_t writer_samples(log_writer_t* w, uint64_t seq, size_t n)
+{
+    static sample_t zero[1024];
+    wav_file_t* wf = w->wf;
+    xample_t* xp = w->xp;
+    uint64_t e = seq + n;
+    uint64_t start, end, s = seq, stale = 0;
+    size_t m;
+    double t0;
+
+    if (wf->skip > 0) {  // rest of a dropped time step
+	m = (wf->skip < n) ? wf->skip : n;
+	wf->skip -= m;
+	s += m;
+    }
+    xample_window(xp, &start, &end);
+    if ((s >= start) && (s - start < w->headroom))
+	w->headroom = s - start;
+    t0 = now_sec();
+    if (s < start) {
+	uint64_t k = ((start < e) ? start : e) - s;
+	stale += k;
+	file_stale(wf, wf->num_samples, k, w->drop ? 'd' : 'z');
+	if (w->drop)
+	    s += writer_drop(w, s, e, k);
+	else {
+	    for (; k > 0; k -= m, s += m) {
+		m = (k > 1024) ? 1024 : k;
+		file_write_samples(zero, m, wf);
+	    }
+	}
+    }
+    while(s < e) {
+	uint64_t pos = wf->num_samples;
+	uint64_t k;
+
+	writer_ring(w, s, e);
+	// the producer may have reached the samples during the write
+	if ((k = xample_check(xp, s, e - s)) == 0)
+	    break;
+	stale += k;
+	file_stale(wf, pos, k, wf->enc ? 't' : (w->drop ? 'd' : 'z'));
+	if (wf->enc)
+	    break;
+	if (!w->drop) {
+	    file_zero_samples(wf, pos, k);
+	    break;
+	}
+	wf->num_samples = pos;
+	s += writer_drop(w, s, e, k);
+    }
+    t0 = now_sec() - t0;
+    w->writes++;
+    w->lat_sum += t0;
+    if (t0 > w->lat_max)
+	w->lat_max = t0;
+    return stale;
+}
+
+// history is written first in the file, when stale the data section
+// is truncated and the history written again from the new window
+static void writer_history(log_writer_t* w, uint64_t hbeg, size_t n)
+{
+    wav_file_t* wf = w->wf;
+    uint64_t hend = hbeg + n;
+    uint64_t start, end;
+    int retry;
+
+    for (retry = 0; retry < 4; retry++) {
+	xample_window(w->xp, &start, &end);
+	if (hend <= start)
+	    break;
+	if (hbeg < start)  // keep the file starting with channel 0
+	    hbeg = hend - ((hend - start) / wf->num_channels)*wf->num_channels;
+	if (writer_samples(w, hbeg, hend - hbeg) == 0)
+	    return;
+	wf->num_samples = 0;  // rewrite, close truncate to written size
+	wf->stale = 0;
+	wf->nstale = 0;
+	wf->skip = 0;
+	if (wf->enc)
+	    xample_enc_rewind(wf->enc);
+    }
+    fprintf(stderr, "history: overwritten by producer, skipped\n");
+}
+
+static void writer_report(log_writer_t* w)
+{
+    unsigned long recycled, removed;
+    uint64_t bytes;
+    size_t nseg;
+
+    xample_seg_stat(w->seg, &nseg, &bytes, &recycled, &removed);
+    printf("segments: %zu (%llu bytes), recycled %lu, removed %lu\n",
+	   nseg, (unsigned long long) bytes, recycled, removed);
+    printf("writer: queue max %zu/%zu (full %lu), write %.3f ms avg "
+	   "%.3f ms max, headroom min %llu samples, stale %llu samples\n",
+	   w->max_depth, w->size, w->full,
+	   w->writes ? 1000*w->lat_sum/w->writes : 0.0, 1000*w->lat_max,
+	   (unsigned long long) w->headroom, (unsigned long long) w->stale);
+}
+
+static void* writer_main(void* arg)
+{
+    log_writer_t* w = arg;
+
+    while(1) {
+	log_req_t r;
+	uint64_t stale;
+
+	pthread_mutex_lock(&w->lock);
+	while(w->count == 0)
+	    pthread_cond_wait(&w->not_empty, &w->lock);
+	r = w->q[w->head];
+	pthread_mutex_unlock(&w->lock);
+
+	switch(r.op) {
+	case LOG_OPEN: {
+	    char name[FILENAME_MAX];
+	    struct timespec ts;
+	    int fd;
+	    ts.tv_sec  = r.seq / 1000000000;
+	    ts.tv_nsec = r.seq % 1000000000;
+	    if (((fd = xample_seg_create(w->seg, &ts,
+					 w->compress ? "xmc" : "wav", r.n,
+					 name, sizeof(name))) < 0) ||
+		((w->wf = file_wav_open(fd, name, w->xp, w->compress)) == NULL))
+		fprintf(stderr, "unable to open file %s [%s]\n", name,
+			strerror(errno));
+	    else
+		printf("open %s\n", name);
+	    break;
+	}
+	case LOG_DATA:
+	    if (w->wf && ((stale = writer_samples(w, r.seq, r.n)) > 0)) {
+		fprintf(stderr, "writer: %llu samples overwritten "
+			"before written\n", (unsigned long long) stale);
+		w->stale += stale;
+		xample_stat_overrun(w->xp, stale);
+	    }
+	    if (w->wf)
+		xample_seg_check(w->seg, w->wf->fd);
+	    break;
+	case LOG_HISTORY:
+	    if (w->wf) {
+		writer_history(w, r.seq, r.n);
+		xample_seg_check(w->seg, w->wf->fd);
+	    }
+	    break;
+	case LOG_CLOSE:
+	    if (w->wf) {
+		char* name = strdup(w->wf->name);
+		if (w->wf->stale > 0) {
+		    char text[512];
+		    file_stale_text(w->wf, text, sizeof(text));
+		    printf("torn %s: %s\n", name, text);
+		}
+		file_wav_close(w->wf);
+		w->wf = NULL;
+		xample_seg_done(w->seg, name);
+		free(name);
+	    }
+	    pthread_mutex_lock(&w->lock);
+	    writer_report(w);
+	    pthread_mutex_unlock(&w->lock);
+	    break;
+	}
+
+	// release the slot after the write, the data is now in the file
+	pthread_mutex_lock(&w->lock);
+	w->head = (w->head + 1) % w->size;
+	w->count--;
+	pthread_cond_signal(&w->not_full);
+	pthread_mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+static void writer_put(log_writer_t* w, int op, uint64_t seq, size_t n,
+		       char* name)
+{
+    log_req_t* r;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->count == w->size) {
+	w->full++;
+	while(w->count == w->size)
+	    pthread_cond_wait(&w->not_full, &w->lock);
+    }
+    r = &w->q[(w->head + w->count) % w->size];
+    r->op   = op;
+    r->seq  = seq;
+    r->n    = n;
+    r->name = name;
+    if (++w->count > w->max_depth)
+	w->max_depth = w->count;
+    pthread_cond_signal(&w->not_empty);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// oldest sample of the queued (or current) writes, seq when none
+static uint64_t writer_oldest(log_writer_t* w, uint64_t seq)
+{
+    size_t i;
+
+    pthread_mutex_lock(&w->lock);
+    for (i = 0; i < w->count; i++) {
+	log_req_t* r = &w->q[(w->head + i) % w->size];
+	if (((r->op == LOG_DATA) || (r->op == LOG_HISTORY)) && (r->seq < seq))
+	    seq = r->seq;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return seq;
+}
+
+static log_writer_t* writer_start(xample_t* xp, sample_t* ring, size_t span,
+				  size_t size, int compress, int drop,
+				  xample_seg_t* seg)
+{
+    log_writer_t* w;
+
+    if ((w = calloc(1, sizeof(log_writer_t))) == NULL)
+	return NULL;
+    if ((w->q = calloc(size, sizeof(log_req_t))) == NULL) {
+	free(w);
+	return NULL;
+    }
+    w->size = size;
+    w->xp   = xp;
+    w->ring = ring;
+    w->span = span;
+    w->compress = compress;
+    w->drop = drop && !compress;  // encoded blocks can not be dropped
+    w->seg = seg;
+    w->headroom = xp->ring_samples;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->not_empty, NULL);
+    pthread_cond_init(&w->not_full, NULL);
+    if ((errno = pthread_create(&w->thread, NULL, writer_main, w)) != 0) {
+	free(w->q);
+	free(w);
+	return NULL;
+    }
+    return w;
+}
+
 size_t page_align(size_t v, int page_size)
 {
     return ((v + page_size - 1) / page_size)*page_size;
 }
 
+
 // parse a trigger expression and store in t
 // simple trigger expession,  all parts are optional
-//    "u:<unsigned>:l:<unsigned>:d:<unsigned>:p:<unsigned>:n:<unsigned>"
+//    "c:<unsigned>:u:<unsigned>:l:<unsigned>:d:<unsigned>:p:<unsigned>:n:<unsigned>"
+// c channel to trigger on (default is any channel)
 // u trigger on above upper limit 
 // l trigger on below lower limit 
 // d trigger on delta
@@ -170,14 +705,20 @@ int parse_trigger(char* expr, trigger_t* t)
 {
     int n;
     unsigned long* argp;
+    unsigned long chan;
     unsigned char m;
 
     if (!expr || !t) return -1;
 
     memset(t, 0, sizeof(trigger_t));
+    t->channel = TRIGGER_ANY_CHANNEL;
 
 again:
     switch(*expr) {
+    case 'c':
+	argp = &chan;
+	m = 0;
+	break;
     case 'u':
 	argp = &t->upper_limit; 
 	m = UPPER_LIMIT_EXCEEDED; 
@@ -210,16 +751,49 @@ again:
     if ((*expr != ':') && (*expr != '\0'))
 	return -1;
     if (*expr == ':') expr++;
+    if (argp == &chan)
+	t->channel = chan;
     t->mask |= m;
     goto again;
 }
 
+// parse <num>[k|M|G]
+uint64_t parse_size(char* arg)
+{
+    char* end;
+    uint64_t v = strtoull(arg, &end, 10);
+
+    switch(*end) {
+    case 'k': case 'K': return v << 10;
+    case 'm': case 'M': return v << 20;
+    case 'g': case 'G': return v << 30;
+    default: return v;
+    }
+}
+
+// check syntax of a (simple or complex) trigger expression
+int check_expr(char* expr)
+{
+    trigger_expr_t* e;
+
+    if (strlen(expr) > MAX_EXPR_LEN)
+	return 0;
+    if ((e = xample_trigger_expr_parse(expr)) == NULL)
+	return 0;
+    xample_trigger_expr_free(e);
+    return 1;
+}
+
 char* format_trigger(trigger_t* t)
 {
     static char buffer[1024];
     char vbuffer[32];
     
     buffer[0] = '\0';
+    if (t->channel != TRIGGER_ANY_CHANNEL) {
+	sprintf(vbuffer, "c:%ld:", t->channel);
+	strcat(buffer, vbuffer);
+    }
     if (t->mask & UPPER_LIMIT_EXCEEDED) {
 	sprintf(vbuffer, "u:%lu:", t->upper_limit);
 	strcat(buffer, vbuffer);
@@ -243,36 +817,297 @@ char* format_trigger(trigger_t* t)
     return buffer;
 }
 
-static inline int eval_trigger(sample_t v, sample_t v0, trigger_t* t)
+// logger state, kept between page batches
+typedef struct {
+    xample_t*   xp;
+    size_t      nchan;
+    trigger_t   cond1[XAMPLE_MAX_CHANNELS];  // start condition per channel
+    trigger_t   cond2[XAMPLE_MAX_CHANNELS];  // stop condition per channel
+    trigger_scan_t scan1;       // compiled cond1 (depend on m0)
+    trigger_scan_t scan2;       // compiled cond2
+    trigger_expr_t* expr1;      // start expression (replace cond1)
+    trigger_expr_t* expr2;      // stop expression (replace cond2)
+    sample_t    v0[XAMPLE_MAX_CHANNELS];     // last samples in previous batch
+    unsigned char m0[XAMPLE_MAX_CHANNELS];   // mask at last trigger
+    int         start;          // logging is active
+    size_t      written;        // samples written to current file
+    size_t      tail;           // samples left of the stop step, then close
+    size_t      max_samples;
+    size_t      max_samples_t;
+    size_t      pre_samples;    // history to write before trigger page
+    log_writer_t* w;
+} logger_t;
+
+// start a new segment named by the time of trigger sample tseq
+static void log_open(logger_t* lp, uint64_t tseq)
+{
+    size_t max = (lp->max_samples < lp->max_samples_t) ?
+	lp->max_samples : lp->max_samples_t;
+    uint64_t ns;
+
+    if (xample_time(lp->xp, tseq, XAMPLE_CLOCK_REALTIME, &ns) < 0) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ns = (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+    }
+    // preallocate for a full file (may end up to a page longer), the
+    // encoded length of a .xmc file is not known, it is not preallocated
+    writer_put(lp->w, LOG_OPEN, ns, lp->w->compress ? 0 :
+	       44 + (max + lp->xp->samples_per_page)*sizeof(sample_t), NULL);
+    lp->written = 0;
+    lp->start = 1;
+}
+
+// add trigger to the per channel conditions
+static int log_add_trigger(logger_t* lp, trigger_t* cond, trigger_t* t)
+{
+    size_t j;
+
+    if (t->channel == TRIGGER_ANY_CHANNEL) {
+	for (j = 0; j < lp->nchan; j++)
+	    xample_trigger_merge(&cond[j], t);
+    }
+    else if ((t->channel >= 0) && (t->channel < lp->nchan))
+	xample_trigger_merge(&cond[t->channel], t);
+    else
+	return -1;
+    return 0;
+}
+
+// join expressions with '|' and compile
+static trigger_expr_t* log_expr(logger_t* lp, char** text, int n, double rate)
 {
-    unsigned char m = t->mask;
-    unsigned char r = 0;
+    char buf[MAX_TRIGGERS*(MAX_EXPR_LEN+3)];
+    trigger_expr_t* e;
+    int j;
 
-    if (m & LIMIT_BITS) {
-	if ((m & UPPER_LIMIT_EXCEEDED)  && (v > t->upper_limit))
-	    r |= UPPER_LIMIT_EXCEEDED;
-	if ((m & BELOW_LOWER_LIMIT) && (v <= t->lower_limit))
-	    r |= BELOW_LOWER_LIMIT;
+    buf[0] = '\0';
+    for (j = 0; j < n; j++) {
+	if (j > 0) strcat(buf, "|");
+	strcat(buf, "(");
+	strcat(buf, text[j]);
+	strcat(buf, ")");
+    }
+    if ((e = xample_trigger_expr_parse(buf)) == NULL)
+	return NULL;
+    if (xample_trigger_expr_compile(e, lp->nchan, rate) < 0) {
+	xample_trigger_expr_free(e);
+	return NULL;
     }
-    if (m & DELTA_BITS) {
-	if (v > v0) {
-	    unsigned long d = v - v0;
-	    if ((m & CHANGED_BY_MORE_THAN_DELTA) && (d > t->delta))
-		r |= CHANGED_BY_MORE_THAN_DELTA;
-	    if ((m & CHANGED_BY_MORE_THAN_POSITIVE_DELTA) 
-		&& (d > t->positive_delta))
-		r |= CHANGED_BY_MORE_THAN_POSITIVE_DELTA;
+    return e;
+}
+
+// the nchan samples before vec[i]
+static sample_t* log_prev(logger_t* lp, sample_t* vec, size_t i,
+			  sample_t* prev)
+{
+    size_t k;
+
+    if (i >= lp->nchan)
+	return vec + i - lp->nchan;
+    for (k = 0; k < lp->nchan; k++)
+	prev[k] = (i+k >= lp->nchan) ? vec[i+k-lp->nchan] : lp->v0[i+k];
+    return prev;
+}
+
+// scan from vec[i] for start (or stop) trigger, return trigger index
+static size_t log_scan(logger_t* lp, int stop, sample_t* vec,
+		       size_t i, size_t n, uint64_t seq)
+{
+    trigger_expr_t* e = stop ? lp->expr2 : lp->expr1;
+    sample_t pbuf[XAMPLE_MAX_CHANNELS];
+    sample_t* v0 = log_prev(lp, vec, i, pbuf);
+
+    if (e)
+	return i + xample_trigger_expr_scan(e, vec+i, n-i, v0, seq+i);
+    return i + xample_trigger_scan(stop ? &lp->scan2 : &lp->scan1,
+				   vec+i, n-i, v0, (seq+i) % lp->nchan);
+}
+
+// queue the pre_samples before sample hend, as much as is still
+// inside the producer window
+static void log_history(logger_t* lp, uint64_t hend)
+{
+    uint64_t start, end, hbeg;
+
+    if (lp->pre_samples == 0)
+	return;
+    xample_window(lp->xp, &start, &end);
+    if (hend <= start)  // all of it overwritten
+	return;
+    hbeg = (hend > lp->pre_samples) ? hend - lp->pre_samples : 0;
+    if (hbeg < start)  // keep the file starting with channel 0
+	hbeg = hend - ((hend - start) / lp->nchan)*lp->nchan;
+    if (hbeg < hend) {
+	printf("history %llu samples\n", (unsigned long long)(hend-hbeg));
+	writer_put(lp->w, LOG_HISTORY, hbeg, hend - hbeg, NULL);
+	lp->written += (hend - hbeg);
+    }
+}
+
+static void log_close(logger_t* lp)
+{
+    writer_put(lp->w, LOG_CLOSE, 0, 0, NULL);
+    lp->start = 0;
+    // new edge state for start trigger
+    xample_trigger_compile(&lp->scan1, lp->cond1, lp->m0, lp->nchan);
+    if (lp->expr1)
+	xample_trigger_expr_rearm(lp->expr1);
+}
+
+// scan n samples (whole pages, contiguous in the ring) starting with
+// sample number seq, run start/stop triggers and write logged pages
+static void log_pages(logger_t* lp, sample_t* vec, size_t n, uint64_t seq)
+{
+    size_t samples_per_page = lp->xp->samples_per_page;
+    size_t nchan = lp->nchan;
+    size_t max_samples = lp->max_samples;
+    size_t i = 0;      // scan position in vec
+    size_t wbeg = 0;   // first sample in vec to write
+    sample_t pbuf[XAMPLE_MAX_CHANNELS];
+
+    if (lp->max_samples_t < max_samples)
+	max_samples = lp->max_samples_t;
+
+    if (lp->tail) {
+	// the stop step continued into this batch
+	i = (lp->tail < n) ? lp->tail : n;
+	writer_put(lp->w, LOG_DATA, seq, i, NULL);
+	lp->written += i;
+	if ((lp->tail -= i) == 0)
+	    log_close(lp);
+	wbeg = i;
+    }
+
+    while(i < n) {
+	size_t k, lim, wend, ch;
+	sample_t v, *v0;
+	unsigned char m;
+	int stop = 0;
+
+	if (!lp->start) {
+	    if ((i = log_scan(lp, 0, vec, i, n, seq)) >= n)
+		break;
+	    ch = (seq+i) % nchan;
+	    v  = vec[i];
+	    v0 = log_prev(lp, vec, i, pbuf);
+	    m  = lp->expr1 ? 0 : eval_trigger(v, v0[0], &lp->cond1[ch]);
+	    printf("start %x[%x] %lu:%zu:%zu (v=%u, v'=%u)\n", m, lp->m0[ch],
+		   xample_offset(lp->xp, seq+i) / samples_per_page,
+		   i % samples_per_page, ch, v, v0[0]);
+	    memset(lp->m0, 0, sizeof(lp->m0));
+	    log_open(lp, seq+i);
+	    // log from page start, the file must begin with channel 0
+	    wbeg = i - (i % samples_per_page);
+	    k = (seq + wbeg) % nchan;
+	    if (wbeg >= k) {
+		wbeg -= k;
+		log_history(lp, seq + wbeg);
+	    }
+	    else {
+		// the trigger step began in the previous batch
+		uint64_t start, end;
+		xample_window(lp->xp, &start, &end);
+		if (seq + wbeg - k >= start) {
+		    // its first channels are still in the ring (log_cursor
+		    // keep nchan samples extra), queue them after the history
+		    log_history(lp, seq + wbeg - k);
+		    writer_put(lp->w, LOG_HISTORY, seq + wbeg - k, k, NULL);
+		    lp->written += k;
+		}
+		else {
+		    // overwritten, start with the next step
+		    wbeg += nchan - k;
+		    if (i < wbeg)
+			i = wbeg;
+		    log_history(lp, seq + wbeg);
+		}
+	    }
+	    i++;
+	}
+
+	// scan for stop trigger up to the page where the file is full
+	k = max_samples - lp->written;
+	lim = wbeg + ((k + samples_per_page - 1) / samples_per_page) *
+	    samples_per_page;
+	if (lim > n)
+	    lim = n;
+	if (i < lim)
+	    i = log_scan(lp, 1, vec, i, lim, seq);
+	if (i < lim) {
+	    ch = (seq+i) % nchan;
+	    v  = vec[i];
+	    v0 = log_prev(lp, vec, i, pbuf);
+	    m  = lp->expr2 ? 0 : eval_trigger(v, v0[0], &lp->cond2[ch]);
+	    printf("stop %x[%x] %lu:%zu:%zu (v=%u, v'=%u)\n", m, lp->m0[ch],
+		   xample_offset(lp->xp, seq+i) / samples_per_page,
+		   i % samples_per_page, ch, v, v0[0]);
+	    lp->m0[ch] = m;
+	    stop = 1;
+	    // log the rest of the page
+	    wend = i - (i % samples_per_page) + samples_per_page;
 	}
-	else if (v < v0) {
-	    unsigned long d = v0 - v;
-	    if ((m & CHANGED_BY_MORE_THAN_DELTA) && (d > t->delta))
-		r |= CHANGED_BY_MORE_THAN_DELTA;
-	    if ((m & CHANGED_BY_MORE_THAN_NEGATIVE_DELTA)
-		&& (d > t->negative_delta))
-		r |= CHANGED_BY_MORE_THAN_NEGATIVE_DELTA;
+	else
+	    wend = lim;
+	// stop if we have had enough
+	if (lp->written + (wend - wbeg) >= max_samples)
+	    stop = 2;
+	// and end the file with the last channel
+	if (stop) {
+	    k = (lp->written + (wend - wbeg)) % nchan;
+	    if ((stop == 1) && (wend - k <= i) && (k > 0)) {
+		// keep the stop sample, finish its step (maybe in
+		// the next batch)
+		k = nchan - k;
+		lp->tail = (wend + k > n) ? wend + k - n : 0;
+		wend = (wend + k > n) ? n : wend + k;
+	    }
+	    else
+		wend -= k;
 	}
+	lp->written += (wend - wbeg);
+	if (stop == 2)
+	    printf("stop #sample = %zu\n", lp->written);
+	if (wend > wbeg)
+	    writer_put(lp->w, LOG_DATA, seq+wbeg, wend-wbeg, NULL);
+	if (stop && !lp->tail)
+	    log_close(lp);
+	wbeg = i = wend;
     }
-    return r;
+    memcpy(lp->v0, log_prev(lp, vec, n, pbuf), nchan*sizeof(sample_t));
+}
+
+// update the reader cursor, samples before the history of a trigger
+// in the page at pos and before the queued writes are not needed
+static void log_cursor(logger_t* lp, int slot, uint64_t pos)
+{
+    uint64_t h = lp->pre_samples + lp->nchan;
+
+    if (slot >= 0)
+	xample_reader_update(lp->xp, slot,
+			     writer_oldest(lp->w, (pos > h) ? pos - h : 0));
+}
+
+// unpack samples [seq, seq+n) of the segment data to ring
+static uint64_t ring_unpack(xample_t* xp, sample_t* data, sample_t* ring,
+			    uint64_t seq, size_t n)
+{
+    uint64_t s = seq, e = seq + n, k;
+
+    while(s < e) {
+	unsigned long offset = xample_offset(xp, s);
+	size_t m = xp->ring_samples - offset;
+	if (m > e - s)
+	    m = e - s;
+	xample_unpack(xp->format, data, offset, m, ring+offset);
+	s += m;
+    }
+    // torn by the producer while unpacking, never pass it on
+    if ((k = xample_check(xp, seq, n)) > 0) {
+	for (s = seq; s < seq + k; s++)
+	    ring[xample_offset(xp, s)] = 0;
+    }
+    return k;
 }
 
 void usage(char* prog)
@@ -281,12 +1116,22 @@ void usage(char* prog)
     printf("  [-t <secs>]       max time in seconds per log file\n"
 	   "  [-n <num>]        max number of samples per log file\n"
 	   "  [-d <dir>]        log directory (default is current dir)\n"
+	   "  [-b <num>]        number of samples before trigger page to log\n"
+	   "  [-q <num>]        writer queue size (default 256)\n"
+	   "  [-z]              write compressed .xmc files (see xample_decode)\n"
+	   "  [-O zero|drop]    samples overwritten before written are zeros\n"
+	   "                    (default) or left out (wav files only)\n"
+	   "  [-K]              critical reader, a lossless producer (-W)\n"
+	   "                    waits instead of overwriting unlogged samples\n"
+	   "  [-r <bytes>[kMG]] keep at most this much log data (default no limit)\n"
+	   "  [-a <secs>]       remove logs older than this (default no limit)\n"
 
 	   "  [-s <trigger>]    start trigger\n"
 	   "  [-e <trigger>]    end trigger\n"
 	   "\n"
 	   " trigger expression:\n"
-	   "    [u:<num>] [l:<num>] [d:<num>] [p:<num] [n:<num>]\n"
+	   "    [c:<num>] [u:<num>] [l:<num>] [d:<num>] [p:<num] [n:<num>]\n"
+	   " c channel to trigger on (default any channel)\n"
            " u trigger on above upper limit\n"
 	   " l trigger on below lower limit\n"
 	   " d trigger on delta\n"
@@ -295,6 +1140,18 @@ void usage(char* prog)
 	   " example: "
 	   " 'u:50000:l:100:d:10' = trigger when above 50000 or below 100 or\n"
 	   "   value change (delta) is more than 10\n"
+	   " -s and -e may be repeated, the triggers are or:ed\n"
+	   "\n"
+	   " complex trigger expression:\n"
+	   "    <trigger> & <trigger>, <trigger> | <trigger>, !<trigger>, (..)\n"
+	   " w:<lo>:<hi> trigger when inside band\n"
+	   " o:<lo>:<hi> trigger when outside band\n"
+	   " h:<num>     hysteresis for u, l, w and o\n"
+	   " N:<num>     condition must hold for num samples in a row\n"
+	   " H:<ms>      holdoff time after trigger\n"
+	   " example: "
+	   " 'c:0:u:50000:h:500:N:4&c:1:w:100:200' = channel 0 above 50000\n"
+	   "   for 4 samples while channel 1 is inside 100..200\n"
 	);
     exit(1);    
 }
@@ -308,35 +1165,50 @@ int main(int argc, char** argv)
     unsigned long first_page;
     unsigned long last_page;
     unsigned long channels;
-    sample_t v0 = 0;
-    unsigned char m0 = 0;
+    unsigned long ring_span;  // contiguous samples from ring
+    sample_t* ring;           // sample_buffer or an unpacked copy
     double rate;
     sample_t* sample_buffer;
     xample_t* xp;
-    int start = 0;
-    int stop = 0;
-    trigger_t cond1;
-    trigger_t cond2;
-    size_t max_samples;
-    size_t max_samples_t;
+    logger_t  lg;
+    uint64_t  pos;            // next sample to process
+    uint64_t  lost = 0;       // samples lost in overruns
+    uint64_t  torn = 0;       // samples overwritten while scanned
+    int    drop = 0;          // drop stale samples (else zeros)
+    int    critical = 0;      // producer in lossless mode waits for us
+    int    slot;              // reader cursor slot
+    unsigned long overruns = 0;
     double max_time;
-    char*   dirname = ".";
-    char   filename[FILENAME_MAX];
-    int    fno = 0;        // 0..9
-    int    opt;
-    wav_file_t* wf;
+    size_t max_log;           // max samples in a log file
+    int    queue_size = DEF_QUEUE_SIZE;
+    int    compress = 0;
+    char*  dirname;
+    uint64_t max_bytes = 0;   // retention budget in bytes
+    double max_age = 0;       // retention budget in seconds
+    xample_seg_t* seg;
+    trigger_t start_cond[MAX_TRIGGERS];
+    trigger_t end_cond[MAX_TRIGGERS];
+    char*  start_text[MAX_TRIGGERS];
+    char*  end_text[MAX_TRIGGERS];
+    int    nstart = 0;
+    int    nend = 0;
+    int    start_expr = 0;  // some start trigger need the expression engine
+    int    end_expr = 0;
+    int    opt, j;
 
-    max_samples = DEF_MAX_SAMPLES;  // max 1M per file!
+    memset(&lg, 0, sizeof(lg));
+    lg.max_samples = DEF_MAX_SAMPLES;  // max 1M per file!
+    dirname     = ".";
     max_time    = DEF_MAX_TIME;     // max 1 minutes
     
     // default: always trigger?  > 0 < 1
-    memset(&cond1, 0, sizeof(cond1));
-    memset(&cond2, 0, sizeof(cond2));
-    cond1.mask = UPPER_LIMIT_EXCEEDED | BELOW_LOWER_LIMIT;
-    cond1.upper_limit = 0;
-    cond1.lower_limit = 1;
+    memset(&start_cond[0], 0, sizeof(trigger_t));
+    start_cond[0].channel = TRIGGER_ANY_CHANNEL;
+    start_cond[0].mask = UPPER_LIMIT_EXCEEDED | BELOW_LOWER_LIMIT;
+    start_cond[0].upper_limit = 0;
+    start_cond[0].lower_limit = 1;
 
-    while ((opt = getopt(argc, argv, "t:d:n:s:e:")) != -1) {
+    while ((opt = getopt(argc, argv, "t:d:n:b:q:zr:a:s:e:O:K")) != -1) {
 	switch(opt) {
 	case 'd':  // set log directory
 	    dirname = optarg;
@@ -345,19 +1217,52 @@ int main(int argc, char** argv)
 	    max_time = atof(optarg);  
 	    break;
 	case 'n': // max number of sample to log per trigger/file
-	    max_samples = atoi(optarg);
+	    lg.max_samples = atoi(optarg);
+	    break;
+	case 'b': // number of samples to log before trigger
+	    lg.pre_samples = atoi(optarg);
+	    break;
+	case 'r': // retention budget in bytes
+	    max_bytes = parse_size(optarg);
+	    break;
+	case 'a': // retention budget in seconds
+	    max_age = atof(optarg);
+	    break;
+	case 'z': // compressed log files
+	    compress = 1;
+	    break;
+	case 'O': // stale sample policy
+	    if (strcmp(optarg, "drop") == 0)
+		drop = 1;
+	    else if (strcmp(optarg, "zero") == 0)
+		drop = 0;
+	    else
+		usage(argv[0]);
+	    break;
+	case 'K': // critical reader, a lossless producer must not lap us
+	    critical = 1;
+	    break;
+	case 'q': // writer queue size
+	    if ((queue_size = atoi(optarg)) < 1)
+		usage(argv[0]);
 	    break;
 	case 's':  // start trigger
-	    if (parse_trigger(optarg, &cond1) < 0) {
+	    if ((nstart >= MAX_TRIGGERS) ||
+		((parse_trigger(optarg, &start_cond[nstart]) < 0) &&
+		 !check_expr(optarg))) {
 		fprintf(stderr, "trigger expression error in %s\n", optarg);
 		exit(1);
 	    }
+	    start_text[nstart++] = optarg;
 	    break;
 	case 'e':  // end trigger
-	    if (parse_trigger(optarg, &cond2) < 0) {
+	    if ((nend >= MAX_TRIGGERS) ||
+		((parse_trigger(optarg, &end_cond[nend]) < 0) &&
+		 !check_expr(optarg))) {
 		fprintf(stderr, "trigger expression error in %s\n", optarg);
 		exit(1);
 	    }
+	    end_text[nend++] = optarg;
 	    break;
 	default:
 	    usage(argv[0]);
@@ -367,11 +1272,38 @@ int main(int argc, char** argv)
     if (optind >= argc)
 	usage(argv[0]);
 
-    if ((xp = xample_open(argv[optind], &sample_buffer)) == NULL) {
+    // a mirrored ring is read across the wrap in one piece
+    ring_span = 0;
+    if ((xp = xample_open(argv[optind], XAMPLE_MAP_MIRROR,
+			  &sample_buffer)) != NULL)
+	ring_span = 2*xp->ring_samples;
+    else if ((xp = xample_open(argv[optind], 0, &sample_buffer)) != NULL)
+	ring_span = xp->ring_samples;
+    else {
 	fprintf(stderr, "unable to open shared memory %s\n", argv[optind]);
 	exit(1);
     }
-
+    lg.xp = xp;
+    // other formats are unpacked to a private 16 bit ring as scanned,
+    // trigger scan and writer read that
+    ring = sample_buffer;
+    if (xp->format != XAMPLE_FMT_U16) {
+	if ((ring = malloc(xp->ring_samples*sizeof(sample_t))) == NULL) {
+	    perror("malloc");
+	    exit(1);
+	}
+	ring_span = xp->ring_samples;
+    }
+    if ((seg = xample_seg_open(dirname, max_bytes, max_age)) == NULL) {
+	fprintf(stderr, "unable to open log directory %s [%s]\n", dirname,
+		strerror(errno));
+	exit(1);
+    }
+    if ((lg.w = writer_start(xp, ring, ring_span, queue_size,
+			     compress, drop, seg)) == NULL) {
+	perror("writer");
+	exit(1);
+    }
     
     current_page = xp->current_page;
     first_page   = xp->first_page;
@@ -381,108 +1313,150 @@ int main(int argc, char** argv)
     rate         = (xp->rate >> 8) + (xp->rate & 0xff)/256.0;
     channels     = xp->channels;
 
-    max_samples_t = rate * max_time;
-    max_samples_t = page_align(max_samples_t, page_size);
+    lg.max_samples_t = rate * max_time * channels;
+    lg.max_samples_t = page_align(lg.max_samples_t, page_size);
+    // a segment (preallocated a page longer) must fit the budget
+    if (max_bytes > 0) {
+	uint64_t m = (max_bytes > 44) ? (max_bytes - 44)/sizeof(sample_t) : 0;
+	m = (m > 2*samples_per_page) ? m - samples_per_page : samples_per_page;
+	if (lg.max_samples > m)
+	    lg.max_samples = m;
+    }
+
+    // history is whole time steps, leave room for the trigger page
+    max_log = (lg.max_samples < lg.max_samples_t) ?
+	lg.max_samples : lg.max_samples_t;
+    if (lg.pre_samples + samples_per_page > max_log)
+	lg.pre_samples = (max_log > samples_per_page) ?
+	    max_log - samples_per_page : 0;
+    // a lossless producer can only run a ring ahead of the history
+    if (critical &&
+	(lg.pre_samples + 2*samples_per_page > xp->ring_samples))
+	lg.pre_samples = (xp->ring_samples > 2*samples_per_page) ?
+	    xp->ring_samples - 2*samples_per_page : 0;
+    lg.pre_samples -= (lg.pre_samples % channels);
+
+    lg.nchan = channels;
+    if (nstart == 0) {
+	nstart = 1;  // default start condition
+	start_text[0] = strdup(format_trigger(&start_cond[0]));
+    }
+    // any trigger that is not a simple condition need the expression
+    // engine, then all of them (start or end) go through it
+    for (j = 0; j < nstart; j++)
+	start_expr |= (parse_trigger(start_text[j], &start_cond[j]) < 0);
+    for (j = 0; j < nend; j++)
+	end_expr |= (parse_trigger(end_text[j], &end_cond[j]) < 0);
+    if (start_expr &&
+	((lg.expr1 = log_expr(&lg, start_text, nstart, rate)) == NULL)) {
+	fprintf(stderr, "unable to compile start trigger\n");
+	exit(1);
+    }
+    if (end_expr &&
+	((lg.expr2 = log_expr(&lg, end_text, nend, rate)) == NULL)) {
+	fprintf(stderr, "unable to compile end trigger\n");
+	exit(1);
+    }
+    for (j = 0; !start_expr && (j < nstart); j++) {
+	if (log_add_trigger(&lg, lg.cond1, &start_cond[j]) < 0) {
+	    fprintf(stderr, "trigger channel error in %s\n",
+		    format_trigger(&start_cond[j]));
+	    exit(1);
+	}
+    }
+    for (j = 0; !end_expr && (j < nend); j++) {
+	if (log_add_trigger(&lg, lg.cond2, &end_cond[j]) < 0) {
+	    fprintf(stderr, "trigger channel error in %s\n",
+		    format_trigger(&end_cond[j]));
+	    exit(1);
+	}
+    }
+    xample_trigger_compile(&lg.scan1, lg.cond1, lg.m0, lg.nchan);
+    xample_trigger_compile(&lg.scan2, lg.cond2, lg.m0, lg.nchan);
 
     printf("max_time = %f\n", max_time);
-    printf("max_samples = %zu\n", max_samples);
-    printf("max_samples_t = %zu\n", max_samples_t);
-    printf("start_cond = %s\n", format_trigger(&cond1));
-    printf("end_cond = %s\n", format_trigger(&cond2));
+    printf("max_samples = %zu\n", lg.max_samples);
+    printf("max_samples_t = %zu\n", lg.max_samples_t);
+    printf("pre_samples = %zu\n", lg.pre_samples);
+    for (j = 0; j < nstart; j++)
+	printf("start_cond = %s\n", start_text[j]);
+    for (j = 0; j < nend; j++)
+	printf("end_cond = %s\n", end_text[j]);
 
     printf("page_size = %ld\n", xp->page_size);
     printf("sample_freq = %f\n", rate);
     printf("samples_per_pages = %zu\n", samples_per_page);
     printf("channels = %lu\n",     channels);
+    printf("format = %s\n", xample_format_name(xp->format));
     printf("first_page = %lu\n",   first_page);
     printf("last_page = %lu\n",    last_page);
     printf("current_page = %lu\n", current_page);
 
-    wf = NULL;
-    start = 0;
-    m0    = 0;
+    // start with the page currently being written
+    pos = xample_seq(xp);
+    pos -= (pos % samples_per_page);
+    if ((slot = xample_reader_register(xp, critical ?
+				       XAMPLE_READER_CRITICAL : 0, pos)) < 0)
+	fprintf(stderr, "no free reader slot, producer will not see us\n");
+    log_cursor(&lg, slot, pos);
+    if (ring != sample_buffer) {  // history for pre trigger samples
+	uint64_t start, end;
+	xample_window(xp, &start, &end);
+	ring_unpack(xp, sample_buffer, ring, start, pos - start);
+    }
 
     while(1) {
-	int page_offset, i;
-	unsigned long page;
+	uint64_t start, end;
 
-	// 10 times / sec
-	while(current_page == xp->current_page) {
-	    usleep(100000);
+	// wait until (at least) one complete page is available
+	xample_window(xp, &start, &end);
+	while(end < pos + samples_per_page) {
+	    // wake up now and then to keep the heartbeat
+	    if (xample_wait(xp, end, XAMPLE_READER_TIMEOUT/4) == 0)
+		log_cursor(&lg, slot, pos);
+	    xample_window(xp, &start, &end);
 	}
-	page = current_page;
-	page_offset = page * samples_per_page;
-	current_page = xp->current_page;
-
-	i = 0;
-	while(!start && (i < samples_per_page)) {
-	    sample_t v = sample_buffer[page_offset+i];
-	    unsigned char m = eval_trigger(v, v0, &cond1);
-	    if (m && ((m & DELTA_BITS) || ((m & ~m0) & LIMIT_BITS))) {
-		printf("start %x[%x] %lu:%d (v=%u, v'=%u)\n", 
-		       m, m0, page, i, v, v0);
-		v0 = v;
-		m0 = m;
-		start = 1;
-	    }
-	    i++;
-	}
-
-	if (start) {
-	    m0 = 0;
-	    size_t written = 0;
 
-	    sprintf(filename, "%s/xam_%d.wav", dirname, fno);
-	    printf("open %s\n", filename);
-	    if ((wf = file_wav_open(filename, xp)) == NULL) {
-		fprintf(stderr, "unable to open file %s [%s]\n", filename,
-			strerror(errno));
-	    }
+	if (pos < start) {
+	    // producer has lapped us, skip to oldest complete page
+	    uint64_t next = ((start + samples_per_page - 1) /
+			     samples_per_page)*samples_per_page;
+	    overruns++;
+	    lost += (next - pos);
+	    xample_stat_overrun(xp, next - pos);
+	    fprintf(stderr, "overrun: lost %llu samples%s "
+		    "(total %llu in %lu overruns)\n",
+		    (unsigned long long) (next - pos),
+		    lg.start ? ", log file has a gap" : "",
+		    (unsigned long long) lost, overruns);
+	    pos = next;
+	}
 
-	    stop = 0;
-
-	    do {
-		while(!stop && (i < samples_per_page)) {
-		    sample_t v = sample_buffer[page_offset+i];
-		    unsigned char m = eval_trigger(v, v0, &cond2);
-		    if (m && ((m & DELTA_BITS) || ((m & ~m0) & LIMIT_BITS))) {
-			printf("stop %x[%x] %lu:%d (v=%u, v'=%u)\n", 
-			       m, m0, page, i, v, v0);
-			v0 = v;
-			m0 = m;
-			stop = 1;
-		    }
-
-		    i++;
-		}
-		written += samples_per_page;
-		if (wf) {
-		    file_write_samples(sample_buffer+page_offset,
-				       samples_per_page, wf);
-		}
-		// stop if we have had enough
-		if ((written >= max_samples) || (written >= max_samples_t)) {
-		    printf("stop #sample = %zu\n", written);
-		    stop = 1;
-		}
-		if (!stop) {
-		    // 10 times / sec
-		    while(current_page == xp->current_page) {
-			usleep(100000);
-		    }
-		    page = current_page;
-		    page_offset = page * samples_per_page;
-		    current_page = xp->current_page;
-		    i = 0;
-		}
-	    } while(!stop);
+	// process the backlog, one batch per contiguous range in the ring
+	// (all of it when mirrored)
+	while(pos + samples_per_page <= end) {
+	    unsigned long offset = xample_offset(xp, pos);
+	    size_t n = ((end - pos) / samples_per_page)*samples_per_page;
+	    uint64_t k = 0;
 
-	    if (wf) {
-		file_wav_close(wf);
-		fno++;
-		if (fno >= 10) fno = 0;
+	    if (n > ring_span - offset)
+		n = ring_span - offset;
+	    if (ring != sample_buffer)
+		k = ring_unpack(xp, sample_buffer, ring, pos, n);
+	    log_pages(&lg, ring+offset, n, pos);
+	    // validate what the triggers saw (the copy when unpacked)
+	    if (ring == sample_buffer)
+		k = xample_check(xp, pos, n);
+	    if (k > 0) {
+		torn += k;
+		xample_stat_overrun(xp, k);
+		fprintf(stderr, "overrun: %llu samples overwritten while "
+			"scanned%s (total %llu)\n", (unsigned long long) k,
+			(ring == sample_buffer) ? ", triggers unreliable" :
+			", zeroed", (unsigned long long) torn);
 	    }
-	    start = 0;
+	    pos += n;
+	    log_cursor(&lg, slot, pos);
 	}
     }
 }
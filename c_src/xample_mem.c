@@ -4,49 +4,231 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <signal.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <linux/futex.h>
+#include <linux/magic.h>
+#endif
 
 #include "xample.h"
 
+// names with a directory part are files (on hugetlbfs), others
+// are shm objects
+static int is_path(char* name)
+{
+    return (name[0] != '\0') && (strchr(name+1, '/') != NULL);
+}
+
+static int seg_open(char* name, int oflag, mode_t mode)
+{
+    if (is_path(name))
+	return open(name, oflag, mode);
+    return shm_open(name, oflag, mode);
+}
+
+static int seg_unlink(char* name)
+{
+    if (is_path(name))
+	return unlink(name);
+    return shm_unlink(name);
+}
+
+// path of name in the default hugetlbfs mount
+static void huge_path(char* name, char* path, size_t len)
+{
+    snprintf(path, len, "%s%s%s", XAMPLE_HUGETLBFS,
+	     (name[0] == '/') ? "" : "/", name);
+}
+
+// page size when fd is on hugetlbfs, 0 otherwise
+static size_t huge_page_size(int fd)
+{
+#if defined(__linux__)
+    struct statfs sfs;
+
+    if ((fstatfs(fd, &sfs) == 0) && (sfs.f_type == HUGETLBFS_MAGIC))
+	return sfs.f_bsize;
+#else
+    (void) fd;
+#endif
+    return 0;
+}
+
+static int map_flags(int flags)
+{
+    int mflags = MAP_SHARED;
+
+#if defined(MAP_POPULATE)
+    if (flags & XAMPLE_MAP_POPULATE)
+	mflags |= MAP_POPULATE;
+#endif
+    return mflags;
+}
+
+// map len bytes of the segment, with mirror_len > 0 the range from
+// mirror_off to len is mapped again directly after the segment
+static void* map_segment(int fd, size_t len, size_t mirror_off,
+			 size_t mirror_len, int prot, int flags, size_t huge)
+{
+    size_t align = huge ? huge : (size_t) sysconf(_SC_PAGE_SIZE);
+    size_t total = len + mirror_len;
+    char* base;
+    char* ptr;
+
+    if (mirror_len == 0) {
+	ptr = mmap(NULL, len, prot, map_flags(flags), fd, (off_t) 0);
+	if (ptr == MAP_FAILED)
+	    return ptr;
+    }
+    else {
+	// reserve (huge page aligned) address space and map over it
+	base = mmap(NULL, total + align, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, (off_t) 0);
+	if (base == MAP_FAILED)
+	    return base;
+	ptr = (char*) (((uintptr_t) base + align - 1) & ~(uintptr_t)(align-1));
+	if (ptr > base)
+	    munmap(base, ptr - base);
+	munmap(ptr + total, (base + align) - ptr);
+	if ((mmap(ptr, len, prot, map_flags(flags) | MAP_FIXED,
+		  fd, (off_t) 0) == MAP_FAILED) ||
+	    (mmap(ptr + len, mirror_len, prot, map_flags(flags) | MAP_FIXED,
+		  fd, (off_t) mirror_off) == MAP_FAILED)) {
+	    munmap(ptr, total);
+	    return MAP_FAILED;
+	}
+    }
+#if defined(MADV_HUGEPAGE)
+    // transparent huge pages for shm (shmem_enabled=advise)
+    if ((flags & XAMPLE_MAP_HUGE) && (huge == 0))
+	madvise(ptr, total, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+// reader mappings with a mirror, they are longer than map_size
+typedef struct _mirror_t {
+    struct _mirror_t* next;
+    void*  addr;
+    size_t len;
+} mirror_t;
+
+static mirror_t* mirrors = NULL;
+
+static size_t gcd(size_t a, size_t b)
+{
+    while(b != 0) {
+	size_t t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+static uint64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
 xample_t* xample_create(char* name, size_t nsamples, size_t fdivpow2,
-			size_t nchannels,
-			double rate, mode_t mode, sample_t** data)
+			size_t nchannels, int format,
+			double rate, mode_t mode, int flags, sample_t** data)
 {
+    char path[FILENAME_MAX];
     size_t page_size;
-    size_t frame_size;
+    size_t bits;
+    size_t spf;
+    size_t spp_size;
+    size_t unit;
     size_t buffer_size;
-    size_t real_size;
+    size_t data_size;
+    size_t data_page;
+    size_t nframes;
+    size_t time_pages;
+    size_t map_size;
+    size_t align;
+    size_t huge = 0;
     void* ptr;
     xample_t* xp;
-    int fd;
+    int fd = -1;
 
     if ((page_size = sysconf(_SC_PAGE_SIZE)) == 0) {
 	fprintf(stderr, "error: sysconf(_SC_PAGE_SIZE) return 0\n");
 	return NULL;
     }
-    buffer_size = nsamples*nchannels*sizeof(sample_t);
-    real_size = (((buffer_size+page_size-1)/page_size)+1)*page_size;
-    frame_size = page_size / (1 << fdivpow2);
+    if (sizeof(xample_t) > page_size) {  // header must fit page 0
+	fprintf(stderr, "error: header size %zu > page size %zu\n",
+		sizeof(xample_t), page_size);
+	return NULL;
+    }
+    if ((bits = xample_format_bits(format)) == 0) {
+	fprintf(stderr, "error: unknown sample format %d\n", format);
+	return NULL;
+    }
 
     // start with trying unlink the segment (delete old one)
     
-    if (shm_unlink(name) < 0) {
-	perror("shm_unlink"); // normally ok if exited nice?
+    if ((seg_unlink(name) < 0) && (errno != ENOENT)) {
+	perror("shm_unlink");
     }
-    if ((fd=shm_open(name, O_CREAT | O_RDWR, mode)) < 0) {
+    huge_path(name, path, sizeof(path));
+    if (!is_path(name))
+	unlink(path);  // from an earlier huge page run
+
+    // plain names go to the hugetlbfs mount when it is there
+    if ((flags & XAMPLE_MAP_HUGE) && !is_path(name)) {
+	if ((fd = open(path, O_CREAT | O_RDWR, mode)) >= 0) {
+	    if ((huge = huge_page_size(fd)) == 0) {
+		close(fd);  // not hugetlbfs
+		unlink(path);
+		fd = -1;
+	    }
+	}
+    }
+    if ((fd < 0) && ((fd=seg_open(name, O_CREAT | O_RDWR, mode)) < 0)) {
 	perror("shm_open");
 	return NULL;
     }
-    if (ftruncate(fd, real_size) < 0) {
+    if (huge == 0)
+	huge = huge_page_size(fd);
+
+    // frames are a power of two samples that fit the frame bytes
+    for (spf = 1; 2*spf*bits <= (page_size >> fdivpow2)*8; spf *= 2)
+	;
+    spp_size = (spf << fdivpow2)*bits/8;  // bytes per sample page
+
+    // data in whole (huge) pages from an aligned offset, so it can be
+    // mapped on its own, and in whole sample pages
+    align = huge ? huge : page_size;
+    unit = (align / gcd(align, spp_size))*spp_size;
+    buffer_size = (nsamples*nchannels*bits + 7)/8;
+    data_size = ((buffer_size + unit - 1) / unit)*unit;
+    nframes = data_size*8/bits/spf;
+    time_pages = (nframes*sizeof(xample_time_t) + page_size - 1) / page_size;
+    data_page = (((1 + time_pages)*page_size + align - 1) / align)*
+	(align / page_size);
+    map_size = data_page*page_size + data_size;
+
+    if (ftruncate(fd, map_size) < 0) {
 	perror("ftruncate");
 	close(fd);
 	return NULL;
     }
-    ptr = mmap(NULL, real_size, PROT_READ | PROT_WRITE, MAP_SHARED, 
-	       fd, (off_t) 0);
+    ptr = map_segment(fd, map_size, 0, 0, PROT_READ | PROT_WRITE,
+		      flags, huge);
     close(fd);
     if (ptr == MAP_FAILED) {
 	perror("mmap");
@@ -55,29 +237,54 @@ xample_t* xample_create(char* name, size_t nsamples, size_t fdivpow2,
     xp = (xample_t*) ptr;
     xp->current_page = 0;
     xp->first_page   = 0;
-    xp->last_page    = (real_size/page_size)-2;
+    xp->last_page    = (data_size/spp_size)-1;
     xp->page_size    = page_size;
-    xp->samples_per_page = page_size / sizeof(sample_t);
+    xp->samples_per_page = spf << fdivpow2;
 
     xp->frames_per_page = (1 << fdivpow2);
     xp->current_frame = 0;
     xp->first_frame   = 0;
     xp->last_frame    = ((xp->last_page-xp->first_page)+1)*
 	xp->frames_per_page-1;
-    xp->frame_size    = frame_size;
-    xp->samples_per_frame = frame_size / sizeof(sample_t);
-
+    xp->frame_size    = spf*bits/8;
+    xp->samples_per_frame = spf;
+    xp->ring_samples  = (xp->last_frame-xp->first_frame+1)*
+	xp->samples_per_frame;
+    xp->seq_lock      = 0;
+    xp->write_seq     = 0;
+    xp->wake_word     = 0;
+    xp->waiters       = 0;
+    xp->time_page     = 1;
+    xp->time_pages    = time_pages;
+    xp->map_flags     = flags;
+    xp->map_size      = map_size;
+    xp->huge_page_size = huge;
+    xp->data_page     = data_page;
+    xp->format        = format;
+    xp->sample_bits   = bits;
+    // an old segment may be reused, forget its readers
+    xp->reader_lag    = 0;
+    xp->reader_count  = 0;
+    xp->blocked       = 0;
+    memset((void*) xp->readers, 0, sizeof(xp->readers));
+    memset((void*) &xp->stat, 0, sizeof(xp->stat));
+    xp->stat.start_ns = clock_ns(CLOCK_REALTIME);
 
     xp->rate         = (unsigned long) (rate*256);
     xp->channels     = nchannels;
-    *data = (sample_t*) (ptr + page_size);
+    *data = (sample_t*) (ptr + data_page*page_size);
     return xp;
 }
 
-xample_t* xample_open(char* name, sample_t** data)
+xample_t* xample_open(char* name, int flags, sample_t** data)
 {
+    char path[FILENAME_MAX];
+    xample_t hdr;
     size_t page_size;
-    size_t buffer_size;
+    size_t prot_size;
+    size_t data_offs;
+    size_t mirror_len = 0;
+    mirror_t* mp = NULL;
     void* ptr;
     int fd;
 
@@ -86,41 +293,361 @@ xample_t* xample_open(char* name, sample_t** data)
 	return NULL;
     }
 
-    if ((fd=shm_open(name, O_RDONLY, 0)) < 0) {
-	perror("shm_open");
-	return NULL;
+    // read/write is needed for the header page (wait registration)
+    if ((fd=seg_open(name, O_RDWR, 0)) < 0) {
+	// a plain name may have been created on hugetlbfs
+	huge_path(name, path, sizeof(path));
+	if (is_path(name) || ((fd = open(path, O_RDWR)) < 0)) {
+	    perror("shm_open");
+	    return NULL;
+	}
     }
 
-    ptr = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, (off_t) 0);
-    if (ptr == MAP_FAILED) {
-	perror("mmap");
+    // read the header, hugetlbfs can not map less than a huge page
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+	perror("read");
 	close(fd);
 	return NULL;
     }
-
-    // calculate size and remap
-    buffer_size = (((xample_t*)ptr)->last_page + 2)*page_size;
-
-    if (munmap(ptr, page_size) < 0) {
-	perror("munmap");
+    if (hdr.page_size != page_size) {
+	fprintf(stderr, "error: segment page size %lu != %zu\n",
+		hdr.page_size, page_size);
 	close(fd);
 	return NULL;
     }
+    data_offs = hdr.data_page*page_size;
+    if (flags & XAMPLE_MAP_MIRROR) {
+	mirror_len = hdr.map_size - data_offs;
+	if ((mp = malloc(sizeof(mirror_t))) == NULL) {
+	    perror("malloc");
+	    close(fd);
+	    return NULL;
+	}
+    }
 
-    ptr = mmap(NULL, buffer_size, PROT_READ, MAP_SHARED, fd, (off_t) 0);
+    ptr = map_segment(fd, hdr.map_size, data_offs, mirror_len, PROT_READ,
+		      hdr.map_flags | flags, hdr.huge_page_size);
     close(fd);
     if (ptr == MAP_FAILED) {
 	perror("mmap");
+	free(mp);
+	return NULL;
+    }
+    // sample data stays read only, except the data sharing the
+    // first huge page with the header
+    prot_size = hdr.huge_page_size ? hdr.huge_page_size : page_size;
+    if (mprotect(ptr, prot_size, PROT_READ | PROT_WRITE) < 0) {
+	perror("mprotect");
+	munmap(ptr, hdr.map_size + mirror_len);
+	free(mp);
 	return NULL;
     }
-    *data = (sample_t*) (ptr + page_size);
+    if (mp != NULL) {
+	mp->addr = ptr;
+	mp->len  = hdr.map_size + mirror_len;
+	mp->next = mirrors;
+	mirrors  = mp;
+    }
+    *data = (sample_t*) (ptr + data_offs);
     return (xample_t*) ptr;
 }
 
+static inline xample_time_t* time_table(xample_t* xp)
+{
+    return (xample_time_t*) ((char*) xp + xp->time_page*xp->page_size);
+}
+
+static inline uint64_t nframes(xample_t* xp)
+{
+    return xp->last_frame - xp->first_frame + 1;
+}
+
+// stamp the frame ending at sample seq
+static void xample_stamp(xample_t* xp, uint64_t seq)
+{
+    xample_time_t* tp;
+
+    if ((xp->time_pages == 0) || (seq == 0) ||
+	((seq % xp->samples_per_frame) != 0))
+	return;
+    tp = &time_table(xp)[(seq/xp->samples_per_frame - 1) % nframes(xp)];
+    __atomic_store_n(&tp->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    tp->mono = clock_ns(CLOCK_MONOTONIC);
+    tp->real = clock_ns(CLOCK_REALTIME);
+    __atomic_store_n(&tp->seq, seq, __ATOMIC_RELEASE);
+}
+
+// read time of the last sample in frame f, return 0 or -1
+static int frame_time(xample_t* xp, uint64_t f, int clock, uint64_t* ns)
+{
+    xample_time_t* tp = &time_table(xp)[f % nframes(xp)];
+    uint64_t end = (f+1)*xp->samples_per_frame;
+    uint64_t s0, s1, t;
+
+    s0 = __atomic_load_n(&tp->seq, __ATOMIC_ACQUIRE);
+    t = (clock == XAMPLE_CLOCK_REALTIME) ? tp->real : tp->mono;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    s1 = __atomic_load_n(&tp->seq, __ATOMIC_RELAXED);
+    if ((s0 != end) || (s1 != end))
+	return -1;
+    *ns = t;
+    return 0;
+}
+
+// nominal ns per sample (all channels)
+static double sample_ns(xample_t* xp)
+{
+    double rate = (xp->rate >> 8) + (xp->rate & 0xff)/256.0;
+    return 1e9 / (rate * xp->channels);
+}
+
+// frames [*lo, *hi] that may have a time entry
+static int frame_range(xample_t* xp, uint64_t* lo, uint64_t* hi)
+{
+    uint64_t n = xample_seq(xp) / xp->samples_per_frame;  // complete frames
+
+    if ((xp->time_pages == 0) || (n == 0))
+	return -1;
+    *hi = n - 1;
+    // the oldest entry may be overwritten next
+    *lo = (n > nframes(xp) - 1) ? n - (nframes(xp) - 1) : 0;
+    return 0;
+}
+
+int xample_time(xample_t* xp, uint64_t seq, int clock, uint64_t* ns)
+{
+    uint64_t spf = xp->samples_per_frame;
+    int retry;
+
+    for (retry = 0; retry < 4; retry++) {
+	uint64_t lo, hi, f, t0, t1;
+	double a, slope;
+
+	if (frame_range(xp, &lo, &hi) < 0)
+	    return -1;
+	f = seq / spf;
+	if (f > hi) f = hi;
+	if (f < lo) f = lo;
+	if (frame_time(xp, f, clock, &t1) < 0)
+	    continue;
+	// slope from the neighbour frame, nominal rate when none
+	slope = sample_ns(xp);
+	if ((f > lo) && (frame_time(xp, f-1, clock, &t0) == 0))
+	    slope = (double)(t1 - t0) / spf;
+	else if ((f < hi) && (frame_time(xp, f+1, clock, &t0) == 0))
+	    slope = (double)(t0 - t1) / spf;
+	a = (double) seq - (double) ((f+1)*spf - 1);
+	*ns = t1 + (int64_t) (a * slope);
+	return 0;
+    }
+    return -1;
+}
+
+int xample_time_seq(xample_t* xp, uint64_t ns, int clock, uint64_t* seq)
+{
+    uint64_t spf = xp->samples_per_frame;
+    int retry;
+
+    for (retry = 0; retry < 4; retry++) {
+	uint64_t lo, hi, l, h, t, t1;
+	double slope;
+	int64_t v;
+
+	if (frame_range(xp, &lo, &hi) < 0)
+	    return -1;
+	// last frame with time <= ns
+	l = lo;
+	h = hi;
+	if ((frame_time(xp, l, clock, &t) < 0))
+	    continue;
+	if (ns >= t) {
+	    while(l < h) {
+		uint64_t m = l + (h - l + 1)/2;
+		if (frame_time(xp, m, clock, &t) < 0)
+		    break;
+		if (t <= ns) l = m; else h = m - 1;
+	    }
+	    if (l < h)
+		continue;
+	}
+	if (frame_time(xp, l, clock, &t) < 0)
+	    continue;
+	slope = sample_ns(xp);
+	if ((l < hi) && (frame_time(xp, l+1, clock, &t1) == 0) && (t1 > t))
+	    slope = (double)(t1 - t) / spf;
+	else if ((l > lo) && (frame_time(xp, l-1, clock, &t1) == 0) && (t > t1))
+	    slope = (double)(t - t1) / spf;
+	v = (int64_t) ((l+1)*spf - 1) +
+	    llround(((double) ns - (double) t) / slope);
+	*seq = (v < 0) ? 0 : v;
+	return 0;
+    }
+    return -1;
+}
+
+void xample_publish(xample_t* xp, uint64_t seq)
+{
+    uint32_t s = xp->seq_lock;
+
+    xample_stamp(xp, seq);
+
+    __atomic_store_n(&xp->seq_lock, s+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    xp->write_seq = seq;
+    // release: sample data and write_seq before even seq_lock
+    __atomic_store_n(&xp->seq_lock, s+2, __ATOMIC_RELEASE);
+
+    // a reader that register after the waiters check will see the
+    // new wake_word value in the kernel and not block
+    __atomic_add_fetch(&xp->wake_word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&xp->waiters, __ATOMIC_SEQ_CST) != 0) {
+#if defined(__linux__)
+	syscall(SYS_futex, &xp->wake_word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+    }
+}
+
+int xample_reader_register(xample_t* xp, int flags, uint64_t seq)
+{
+    uint32_t pid = (uint32_t) getpid();
+    int i;
+
+    for (i = 0; i < XAMPLE_MAX_READERS; i++) {
+	xample_reader_t* rp = &xp->readers[i];
+	uint32_t free_pid = 0;
+	// heartbeat and cursor are set while flags is 0, so the
+	// producer does not wait for a half registered reader
+	if (__atomic_compare_exchange_n(&rp->pid, &free_pid, pid, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	    rp->flags = 0;
+	    xample_reader_update(xp, i, seq);
+	    __atomic_store_n(&rp->flags, flags, __ATOMIC_RELEASE);
+	    return i;
+	}
+    }
+    return -1;
+}
+
+void xample_reader_update(xample_t* xp, int slot, uint64_t seq)
+{
+    xample_reader_t* rp = &xp->readers[slot];
+
+    __atomic_store_n(&rp->heartbeat, clock_ns(CLOCK_MONOTONIC),
+		     __ATOMIC_RELAXED);
+    // release: reads of the samples before seq are done
+    __atomic_store_n(&rp->read_seq, seq, __ATOMIC_RELEASE);
+}
+
+void xample_reader_release(xample_t* xp, int slot)
+{
+    if ((slot >= 0) && (slot < XAMPLE_MAX_READERS)) {
+	__atomic_store_n(&xp->readers[slot].flags, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&xp->readers[slot].pid, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void xample_stat_overrun(xample_t* xp, uint64_t lost)
+{
+    __atomic_fetch_add(&xp->stat.overruns, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&xp->stat.lost, lost, __ATOMIC_RELAXED);
+}
+
+uint64_t xample_reader_scan(xample_t* xp, uint64_t seq)
+{
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    uint64_t timeout = (uint64_t) XAMPLE_READER_TIMEOUT*1000000;
+    uint64_t critical = seq;
+    uint64_t lag = 0;
+    uint32_t count = 0;
+    int i;
+
+    for (i = 0; i < XAMPLE_MAX_READERS; i++) {
+	xample_reader_t* rp = &xp->readers[i];
+	uint32_t pid = __atomic_load_n(&rp->pid, __ATOMIC_ACQUIRE);
+	uint64_t rseq, beat;
+
+	if (pid == 0)
+	    continue;
+	rseq = __atomic_load_n(&rp->read_seq, __ATOMIC_ACQUIRE);
+	beat = __atomic_load_n(&rp->heartbeat, __ATOMIC_RELAXED);
+	if (beat + timeout < now) {
+	    // silent, reclaim the slot if the process is gone
+	    if ((kill((pid_t) pid, 0) < 0) && (errno == ESRCH))
+		__atomic_compare_exchange_n(&rp->pid, &pid, 0, 0,
+					    __ATOMIC_ACQ_REL,
+					    __ATOMIC_RELAXED);
+	    continue;
+	}
+	count++;
+	if ((rseq < seq) && (seq - rseq > lag))
+	    lag = seq - rseq;
+	if ((__atomic_load_n(&rp->flags, __ATOMIC_ACQUIRE) &
+	     XAMPLE_READER_CRITICAL) && (rseq < critical))
+	    critical = rseq;
+    }
+    xp->reader_lag = lag;
+    xp->reader_count = count;
+    return critical;
+}
+
+int xample_wait(xample_t* xp, uint64_t last_seq, int timeout)
+{
+    struct timespec t0, t1, ts;
+    long us = 0;
+    int r;
+
+    if (timeout >= 0)
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while(1) {
+	uint32_t w = __atomic_load_n(&xp->wake_word, __ATOMIC_SEQ_CST);
+
+	if (xample_seq(xp) != last_seq)
+	    return 1;
+	if (timeout >= 0) {
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    us = timeout*1000L - ((t1.tv_sec-t0.tv_sec)*1000000L +
+				  (t1.tv_nsec-t0.tv_nsec)/1000);
+	    if (us <= 0)
+		return 0;
+	    ts.tv_sec  = us / 1000000;
+	    ts.tv_nsec = (us % 1000000)*1000;
+	}
+#if defined(__linux__)
+	__atomic_add_fetch(&xp->waiters, 1, __ATOMIC_SEQ_CST);
+	r = syscall(SYS_futex, &xp->wake_word, FUTEX_WAIT, w,
+		    (timeout >= 0) ? &ts : NULL, NULL, 0);
+	__atomic_sub_fetch(&xp->waiters, 1, __ATOMIC_SEQ_CST);
+	if ((r < 0) && (errno != EAGAIN) && (errno != EINTR) &&
+	    (errno != ETIMEDOUT)) {
+	    perror("futex");
+	    return -1;
+	}
+#else
+	// no futex, poll the wake word with a short sleep
+	(void) w;
+	(void) r;
+	usleep(((timeout >= 0) && (us < 1000)) ? us : 1000);
+#endif
+    }
+}
+
 int xample_close(xample_t* xp)
 {
+    mirror_t** mpp;
+
     if (xp != NULL) {
-	size_t len = (xp->last_page + 2)*xp->page_size;
+	size_t len = xp->map_size;
+	for (mpp = &mirrors; *mpp != NULL; mpp = &(*mpp)->next) {
+	    if ((*mpp)->addr == (void*) xp) {
+		mirror_t* mp = *mpp;
+		len = mp->len;
+		*mpp = mp->next;
+		free(mp);
+		break;
+	    }
+	}
 	return munmap((void*) xp, len);
     }
     return 0;
@@ -0,0 +1,164 @@
+//
+// Sample pacing
+//
+// A running schedule of absolute deadlines, one tick per sample. Each
+// wait advance the deadline by n ticks and sleep until it with
+// clock_nanosleep(TIMER_ABSTIME), so sleep overshoot and read time do
+// not accumulate as drift. With a busy tail the sleep ends busy_ns
+// early and the rest is spun on the clock, for short periods where the
+// sleep wakeup latency is larger than the period.
+//
+// Lateness (wakeup time - deadline) is collected for jitter stats,
+// and in the segment counters when stat is set.
+//
+#if defined(__linux__)
+#define _GNU_SOURCE   // sched_setaffinity
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "xample.h"
+
+#define PACE_RESYNC_NS  100000000  // restart schedule when 100ms late
+
+static inline int64_t ts_ns(struct timespec* ts)
+{
+    return (int64_t) ts->tv_sec*1000000000 + ts->tv_nsec;
+}
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts_ns(&ts);
+}
+
+uint64_t xample_pace_clock(void)
+{
+    return (uint64_t) now_ns();
+}
+
+void xample_stat_read(xample_stat_t* st, uint64_t ns)
+{
+    xample_stat_add(&st->reads, 1);
+    xample_stat_add(&st->read_ns, ns);
+    xample_stat_max(&st->read_max_ns, ns);
+    xample_stat_hist(st->read_hist, ns);
+}
+
+void xample_pace_init(xample_pace_t* p, double tick_hz, long busy_ns)
+{
+    memset(p, 0, sizeof(xample_pace_t));
+    p->period = 1e9 / tick_hz;
+    p->busy_ns = busy_ns;
+    p->t0 = now_ns();
+    xample_pace_reset_stat(p);
+}
+
+void xample_pace_wait(xample_pace_t* p, size_t n)
+{
+    struct timespec ts;
+    int64_t deadline, wake, late;
+
+    p->ticks += n;
+    deadline = p->t0 + (int64_t) (p->ticks * p->period);
+    wake = deadline - p->busy_ns;
+    ts.tv_sec  = wake / 1000000000;
+    ts.tv_nsec = wake % 1000000000;
+#if defined(__linux__)
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	;
+#else
+    {
+	int64_t d = wake - now_ns();
+	if (d > 0)
+	    usleep(d / 1000);
+    }
+#endif
+    while((late = now_ns() - deadline) < 0)
+	;  // busy tail
+    if (late > PACE_RESYNC_NS) {
+	// far behind (stopped, or reads slower than the rate)
+	p->t0 = now_ns();
+	p->ticks = 0;
+	p->resync++;
+	if (p->stat)
+	    xample_stat_add(&p->stat->resyncs, 1);
+	return;
+    }
+    if (p->stat) {
+	xample_stat_add(&p->stat->paced, 1);
+	xample_stat_add(&p->stat->late_ns, late);
+	xample_stat_max(&p->stat->late_max_ns, late);
+	xample_stat_hist(p->stat->late_hist, late);
+    }
+    p->n++;
+    p->sum += late;
+    p->sum2 += (double) late * late;
+    if (late < p->min) p->min = late;
+    if (late > p->max) p->max = late;
+}
+
+void xample_pace_reset_stat(xample_pace_t* p)
+{
+    p->n = 0;
+    p->sum = 0;
+    p->sum2 = 0;
+    p->min = INT64_MAX;
+    p->max = 0;
+}
+
+void xample_pace_print(xample_pace_t* p)
+{
+    double avg, sd;
+
+    if (p->n == 0)
+	return;
+    avg = p->sum / p->n;
+    sd  = sqrt(fmax(0.0, p->sum2 / p->n - avg*avg));
+    printf("jitter: min %.1f us, avg %.1f us, max %.1f us, sd %.1f us, "
+	   "resync %lu\n", p->min/1000.0, avg/1000.0, p->max/1000.0,
+	   sd/1000.0, p->resync);
+}
+
+int xample_rt_setup(int prio, int cpu, int lock)
+{
+    int r = 0;
+
+    if (lock && (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)) {
+	perror("mlockall");
+	r = -1;
+    }
+#if defined(__linux__)
+    if (cpu >= 0) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+	    perror("sched_setaffinity");
+	    r = -1;
+	}
+    }
+    if (prio > 0) {
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = prio;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+	    perror("sched_setscheduler");
+	    r = -1;
+	}
+    }
+#else
+    (void) cpu;
+    (void) prio;
+#endif
+    return r;
+}
@@ -0,0 +1,223 @@
+//
+// Log segment files
+//
+// Segments are named <dir>/xam_<yyyymmdd>-<hhmmss>.<ms>.<ext> from the
+// (UTC) trigger time, so name order is time order. Existing segments
+// in the directory are picked up at start.
+//
+// A retention budget (total allocated bytes and/or age) is checked
+// before each new segment and while a segment is written, the oldest
+// segments over budget expire.
+// The first expired segment is renamed and reused for the new one so
+// its blocks stay allocated, the rest are removed. New segments are
+// preallocated (beyond end of file) so writing does not allocate.
+//
+#if defined(__linux__)
+#define _GNU_SOURCE   // fallocate
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "xample.h"
+
+#define SEG_PREFIX  "xam_"
+
+typedef struct {
+    char*    name;     // path
+    time_t   mtime;
+    uint64_t bytes;    // allocated bytes
+} seg_t;
+
+struct _xample_seg_t {
+    char*    dirname;
+    uint64_t max_bytes;   // 0 = no limit
+    double   max_age;     // seconds, 0 = no limit
+    seg_t*   seg;         // oldest first
+    size_t   nseg;
+    size_t   size;
+    uint64_t bytes;       // total allocated bytes
+    unsigned long recycled;
+    unsigned long removed;
+};
+
+static int seg_cmp(const void* a, const void* b)
+{
+    return strcmp(((seg_t*)a)->name, ((seg_t*)b)->name);
+}
+
+static int seg_add(xample_seg_t* sp, char* name, struct stat* st)
+{
+    if (sp->nseg == sp->size) {
+	size_t size = sp->size ? 2*sp->size : 64;
+	seg_t* seg = realloc(sp->seg, size*sizeof(seg_t));
+	if (seg == NULL)
+	    return -1;
+	sp->seg = seg;
+	sp->size = size;
+    }
+    sp->seg[sp->nseg].name  = strdup(name);
+    sp->seg[sp->nseg].mtime = st->st_mtime;
+    sp->seg[sp->nseg].bytes = (uint64_t) st->st_blocks * 512;
+    sp->bytes += sp->seg[sp->nseg].bytes;
+    sp->nseg++;
+    return 0;
+}
+
+// remove the oldest segment from the list, return its name
+static char* seg_pop(xample_seg_t* sp)
+{
+    char* name = sp->seg[0].name;
+
+    sp->bytes -= sp->seg[0].bytes;
+    memmove(&sp->seg[0], &sp->seg[1], (sp->nseg-1)*sizeof(seg_t));
+    sp->nseg--;
+    return name;
+}
+
+static int seg_expired(xample_seg_t* sp, uint64_t need, time_t now)
+{
+    if (sp->nseg == 0)
+	return 0;
+    if ((sp->max_bytes > 0) && (sp->bytes + need > sp->max_bytes))
+	return 1;
+    if ((sp->max_age > 0) && (difftime(now, sp->seg[0].mtime) > sp->max_age))
+	return 1;
+    return 0;
+}
+
+// unlink an expired segment
+static void seg_remove(xample_seg_t* sp, char* name)
+{
+    if (unlink(name) == 0)
+	sp->removed++;
+    else
+	perror(name);
+    free(name);
+}
+
+xample_seg_t* xample_seg_open(char* dirname, uint64_t max_bytes,
+			      double max_age)
+{
+    xample_seg_t* sp;
+    struct dirent* de;
+    DIR* dir;
+
+    if ((sp = calloc(1, sizeof(xample_seg_t))) == NULL)
+	return NULL;
+    sp->dirname   = strdup(dirname);
+    sp->max_bytes = max_bytes;
+    sp->max_age   = max_age;
+    if ((dir = opendir(dirname)) == NULL) {
+	xample_seg_close(sp);
+	return NULL;
+    }
+    while((de = readdir(dir)) != NULL) {
+	char path[FILENAME_MAX];
+	struct stat st;
+	// old style xam_0..9 names are left alone
+	if ((strncmp(de->d_name, SEG_PREFIX, strlen(SEG_PREFIX)) != 0) ||
+	    (strlen(de->d_name) < strlen(SEG_PREFIX) + 15))
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", dirname, de->d_name);
+	if ((stat(path, &st) == 0) && S_ISREG(st.st_mode))
+	    seg_add(sp, path, &st);
+    }
+    closedir(dir);
+    qsort(sp->seg, sp->nseg, sizeof(seg_t), seg_cmp);
+    return sp;
+}
+
+int xample_seg_create(xample_seg_t* sp, struct timespec* ts, char* ext,
+		      uint64_t prealloc, char* name, size_t len)
+{
+    char* reuse = NULL;
+    time_t now = time(NULL);
+    struct tm tm;
+    int fd, i;
+
+    gmtime_r(&ts->tv_sec, &tm);
+    for (i = 0; ; i++) {
+	struct stat st;
+	int n = snprintf(name, len, "%s/" SEG_PREFIX
+			 "%04d%02d%02d-%02d%02d%02d.%03ld",
+			 sp->dirname, tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday,
+			 tm.tm_hour, tm.tm_min, tm.tm_sec, ts->tv_nsec/1000000);
+	if (i > 0)
+	    n += snprintf(name+n, len-n, "-%d", i);
+	snprintf(name+n, len-n, ".%s", ext);
+	if (stat(name, &st) < 0)
+	    break;
+    }
+
+    // expire segments over budget, keep the first one for reuse
+    while(seg_expired(sp, prealloc, now)) {
+	char* old = seg_pop(sp);
+	if ((reuse == NULL) && (rename(old, name) == 0)) {
+	    reuse = old;
+	    sp->recycled++;
+	    continue;
+	}
+	seg_remove(sp, old);
+    }
+    free(reuse);
+
+    // a reused segment is overwritten in place, no truncate
+    if ((fd = open(name, O_WRONLY|O_CREAT, 0666)) < 0)
+	return -1;
+#if defined(__linux__)
+    // allocate blocks but keep size, failure is not an error
+    if (prealloc > 0)
+	fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, prealloc);
+#endif
+    return fd;
+}
+
+void xample_seg_check(xample_seg_t* sp, int fd)
+{
+    time_t now = time(NULL);
+    uint64_t bytes = 0;
+    struct stat st;
+
+    if ((sp->max_bytes == 0) && (sp->max_age == 0))
+	return;
+    if (fstat(fd, &st) == 0)
+	bytes = (uint64_t) st.st_blocks * 512;
+    while(seg_expired(sp, bytes, now))
+	seg_remove(sp, seg_pop(sp));
+}
+
+void xample_seg_done(xample_seg_t* sp, char* name)
+{
+    struct stat st;
+
+    if (stat(name, &st) == 0)
+	seg_add(sp, name, &st);
+}
+
+void xample_seg_stat(xample_seg_t* sp, size_t* nseg, uint64_t* bytes,
+		     unsigned long* recycled, unsigned long* removed)
+{
+    *nseg = sp->nseg;
+    *bytes = sp->bytes;
+    *recycled = sp->recycled;
+    *removed = sp->removed;
+}
+
+void xample_seg_close(xample_seg_t* sp)
+{
+    size_t i;
+
+    for (i = 0; i < sp->nseg; i++)
+	free(sp->seg[i].name);
+    free(sp->seg);
+    free(sp->dirname);
+    free(sp);
+}
@@ -0,0 +1,336 @@
+//
+// Signal simulator
+//
+// One generator per channel, filled in bulk into interleaved samples
+// continuous from channel 0. The state is per channel and the noise
+// and spike positions come from a per channel PRNG seeded from the
+// simulator seed, so a run is reproducible from (seed, specs).
+//
+// spec    := kind { ':' key ':' <num> }
+// kind    := 'dc' | 'sine' | 'square' | 'chirp' | 'noise'
+// key     := 'f'   frequency Hz (sine, square, chirp start)
+//          | 'g'   chirp end frequency Hz
+//          | 't'   chirp sweep time ms, then restart at f
+//          | 'd'   square duty cycle percent (50)
+//          | 'a'   amplitude (peak, 16 bit units, 10000)
+//          | 'o'   offset (32768)
+//          | 'n'   added noise amplitude (triangular, noise kind a)
+//          | 'p'   spike mean interval in samples (0 = no spikes)
+//          | 'h'   spike height, added to one sample
+//
+// Sine and chirp use a complex rotator (no sin() per sample), the
+// chirp rotator step is itself rotated by a constant. Rotators are
+// renormalized every SIM_BLOCK samples.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "xample.h"
+
+#define SIM_BLOCK  256   // samples per channel and block
+
+#define SIM_DC      0
+#define SIM_SINE    1
+#define SIM_SQUARE  2
+#define SIM_CHIRP   3
+#define SIM_NOISE   4
+
+static const char* sim_kinds[] = {
+    [SIM_DC]     = "dc",
+    [SIM_SINE]   = "sine",
+    [SIM_SQUARE] = "square",
+    [SIM_CHIRP]  = "chirp",
+    [SIM_NOISE]  = "noise",
+};
+
+typedef struct {
+    int      kind;
+    double   f, g, t, duty;
+    double   amp, offset, noise;
+    double   spike_height;
+    uint64_t spike_interval;
+    // state
+    uint64_t rng;           // noise
+    uint64_t spike_rng;     // spike positions
+    double   zr, zi;        // rotator
+    double   wr, wi;        // rotator step
+    double   dr, di;        // step rotation (chirp)
+    uint64_t sweep_len;     // chirp samples per sweep
+    uint64_t sweep_pos;
+    uint32_t phase;         // square
+    uint32_t phase_inc;
+    uint32_t duty_level;
+    uint64_t next_spike;    // samples to next spike
+    uint64_t pos;           // samples generated
+} sim_chan_t;
+
+struct _xample_sim_t {
+    size_t     nchan;
+    size_t     chan;        // channel of next sample
+    double     rate;        // per channel
+    uint64_t   seed;
+    sim_chan_t ch[XAMPLE_MAX_CHANNELS];
+};
+
+// splitmix64, seeding
+static uint64_t splitmix(uint64_t* x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// xorshift64*
+static inline uint64_t rng_next(uint64_t* s)
+{
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+// -1 .. 1, triangular
+static inline double rng_tri(uint64_t* s)
+{
+    uint64_t r = rng_next(s);
+    return ((double)(r >> 40) + (double)((r >> 16) & 0xffffff)) /
+	(double)(1 << 24) - 1.0;
+}
+
+static uint64_t spike_gap(sim_chan_t* g)
+{
+    // uniform in interval/2 .. interval*3/2
+    return g->spike_interval/2 +
+	rng_next(&g->spike_rng) % (g->spike_interval+1);
+}
+
+// (re)start the generator state from the parameters
+static void chan_reset(xample_sim_t* sp, size_t c)
+{
+    sim_chan_t* g = &sp->ch[c];
+    uint64_t x = sp->seed*XAMPLE_MAX_CHANNELS + c;
+    double w = 2*M_PI*g->f/sp->rate;
+
+    g->rng = splitmix(&x) | 1;
+    g->spike_rng = splitmix(&x) | 1;
+    g->zr = 1.0; g->zi = 0.0;
+    g->wr = cos(w); g->wi = sin(w);
+    g->sweep_len = (uint64_t) (g->t/1000.0*sp->rate);
+    if (g->sweep_len > 0) {
+	double dw = 2*M_PI*(g->g - g->f)/sp->rate/g->sweep_len;
+	g->dr = cos(dw); g->di = sin(dw);
+    }
+    else {
+	g->dr = 1.0; g->di = 0.0;
+    }
+    g->sweep_pos = 0;
+    g->pos = 0;
+    g->phase = 0;
+    g->phase_inc = (uint32_t) (fmod(g->f/sp->rate, 1.0)*4294967296.0);
+    g->duty_level = (uint32_t) (g->duty/100.0*4294967295.0);
+    g->next_spike = (g->spike_interval > 0) ? spike_gap(g) : 0;
+}
+
+xample_sim_t* xample_sim_new(size_t nchan, double rate, uint64_t seed)
+{
+    xample_sim_t* sp;
+    size_t c;
+
+    if ((nchan < 1) || (nchan > XAMPLE_MAX_CHANNELS) || (rate <= 0))
+	return NULL;
+    if ((sp = calloc(1, sizeof(xample_sim_t))) == NULL)
+	return NULL;
+    sp->nchan = nchan;
+    sp->rate = rate;
+    sp->seed = seed;
+    for (c = 0; c < nchan; c++) {
+	char spec[64];
+	// default: sines at different frequencies, a little noise
+	snprintf(spec, sizeof(spec), "sine:f:%g:a:20000:n:50",
+		 rate/1000.0*(c+1));
+	xample_sim_config(sp, c, spec);
+    }
+    return sp;
+}
+
+void xample_sim_free(xample_sim_t* sp)
+{
+    free(sp);
+}
+
+int xample_sim_config(xample_sim_t* sp, size_t c, char* spec)
+{
+    sim_chan_t g;
+    char* ptr = spec;
+    size_t i, len;
+
+    if (c >= sp->nchan)
+	return -1;
+    memset(&g, 0, sizeof(g));
+    g.kind = -1;
+    g.f = 1.0;
+    g.duty = 50.0;
+    g.amp = 10000.0;
+    g.offset = 32768.0;
+    len = strcspn(ptr, ":");
+    for (i = 0; i < sizeof(sim_kinds)/sizeof(sim_kinds[0]); i++) {
+	if ((strlen(sim_kinds[i]) == len) &&
+	    (strncmp(ptr, sim_kinds[i], len) == 0))
+	    g.kind = i;
+    }
+    if (g.kind < 0)
+	return -1;
+    ptr += len;
+    while(*ptr == ':') {
+	char key = ptr[1];
+	char* end;
+	double v;
+
+	if ((key == '\0') || (ptr[2] != ':'))
+	    return -1;
+	v = strtod(ptr+3, &end);
+	if (end == ptr+3)
+	    return -1;
+	switch(key) {
+	case 'f': g.f = v; break;
+	case 'g': g.g = v; break;
+	case 't': g.t = v; break;
+	case 'd': g.duty = v; break;
+	case 'a': g.amp = v; break;
+	case 'o': g.offset = v; break;
+	case 'n': g.noise = v; break;
+	case 'p': g.spike_interval = (v < 0) ? 0 : (uint64_t) v; break;
+	case 'h': g.spike_height = v; break;
+	default: return -1;
+	}
+	ptr = end;
+    }
+    if (*ptr != '\0')
+	return -1;
+    if ((g.kind == SIM_CHIRP) && (g.t <= 0))
+	return -1;
+    if ((g.kind == SIM_NOISE) && (g.noise == 0))
+	g.noise = g.amp;
+    sp->ch[c] = g;
+    chan_reset(sp, c);
+    return 0;
+}
+
+void xample_sim_reset(xample_sim_t* sp)
+{
+    size_t c;
+
+    sp->chan = 0;
+    for (c = 0; c < sp->nchan; c++)
+	chan_reset(sp, c);
+}
+
+static void normalize(double* re, double* im)
+{
+    double norm = 1.0 / sqrt(*re * *re + *im * *im);
+    *re *= norm;
+    *im *= norm;
+}
+
+// n samples of channel generator g to dst with stride
+static void chan_fill(xample_sim_t* sp, sim_chan_t* g, sample_t* dst,
+		      size_t n, size_t stride)
+{
+    double buf[SIM_BLOCK];
+
+    while(n > 0) {
+	// blocks end on multiples of SIM_BLOCK channel samples, so the
+	// output does not depend on how the fills are chunked
+	size_t m = SIM_BLOCK - (g->pos % SIM_BLOCK);
+	size_t i;
+	int renorm;
+
+	if (m > n)
+	    m = n;
+	g->pos += m;
+	renorm = (g->pos % SIM_BLOCK) == 0;
+	switch(g->kind) {
+	case SIM_DC:
+	case SIM_NOISE:
+	    for (i = 0; i < m; i++)
+		buf[i] = g->offset;
+	    break;
+	case SIM_SINE:
+	    for (i = 0; i < m; i++) {
+		double zr = g->zr*g->wr - g->zi*g->wi;
+		g->zi = g->zr*g->wi + g->zi*g->wr;
+		g->zr = zr;
+		buf[i] = g->offset + g->amp*g->zi;
+	    }
+	    if (renorm)
+		normalize(&g->zr, &g->zi);
+	    break;
+	case SIM_CHIRP:
+	    for (i = 0; i < m; i++) {
+		double zr = g->zr*g->wr - g->zi*g->wi;
+		double wr = g->wr*g->dr - g->wi*g->di;
+		g->zi = g->zr*g->wi + g->zi*g->wr;
+		g->zr = zr;
+		g->wi = g->wr*g->di + g->wi*g->dr;
+		g->wr = wr;
+		buf[i] = g->offset + g->amp*g->zi;
+		if (++g->sweep_pos >= g->sweep_len) {
+		    double w = 2*M_PI*g->f/sp->rate;
+		    g->wr = cos(w); g->wi = sin(w);
+		    g->sweep_pos = 0;
+		}
+	    }
+	    if (renorm) {
+		normalize(&g->zr, &g->zi);
+		normalize(&g->wr, &g->wi);
+	    }
+	    break;
+	case SIM_SQUARE:
+	    for (i = 0; i < m; i++) {
+		buf[i] = g->offset +
+		    ((g->phase < g->duty_level) ? g->amp : -g->amp);
+		g->phase += g->phase_inc;
+	    }
+	    break;
+	}
+	if (g->noise != 0) {
+	    for (i = 0; i < m; i++)
+		buf[i] += g->noise*rng_tri(&g->rng);
+	}
+	if (g->spike_interval > 0) {
+	    uint64_t k = g->next_spike;
+	    while(k < m) {
+		buf[k] += g->spike_height;
+		k += spike_gap(g);
+	    }
+	    g->next_spike = k - m;
+	}
+	for (i = 0; i < m; i++) {
+	    double v = buf[i];
+	    v = (v < 0) ? 0 : ((v > 65535) ? 65535 : v);
+	    *dst = (sample_t) v;
+	    dst += stride;
+	}
+	n -= m;
+    }
+}
+
+void xample_sim_fill(xample_sim_t* sp, sample_t* samples, size_t n)
+{
+    size_t c;
+
+    for (c = 0; c < sp->nchan; c++) {
+	// first sample of channel c in this fill
+	size_t j = (c + sp->nchan - sp->chan) % sp->nchan;
+	if (j < n)
+	    chan_fill(sp, &sp->ch[c], samples + j,
+		      (n - j + sp->nchan - 1) / sp->nchan, sp->nchan);
+    }
+    sp->chan = (sp->chan + n) % sp->nchan;
+}
@@ -0,0 +1,319 @@
+//
+// SPI acquisition engine (MCP3202 on spidev)
+//
+// A thread runs the SPI transfers into a ring of batch buffers (double
+// or triple buffered) while the producer decodes the previous batch,
+// so transfer setup, the ioctl and decoding overlap. The transfer
+// descriptors and tx bytes of each buffer are built once: a batch is a
+// whole number of time steps so each buffer always starts on channel 0.
+// Batches larger than SPI_MAX_MSG transfers are split in several
+// messages, the engine paces (xample_pace_wait) after each message.
+//
+// With fd < 0 a mock spidev is used, it answers as an MCP3202 with a
+// sawtooth per input channel (channel c step c+1) and blocks for the transfer
+// time of the message, for testing without hardware.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "xample.h"
+
+#if defined(__linux__)
+
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+#define SPI_MAX_MSG  256   // transfers per SPI_IOC_MESSAGE
+#define SPI_XFER     3     // bytes per MCP3202 conversion
+#define SPI_SLACK_US 200   // per message, for the engine wakeup
+#define MOCK_SPIN_NS 50000
+
+typedef struct {
+    uint8_t* tx;
+    uint8_t* rx;
+    struct spi_ioc_transfer* tr;
+} spi_buf_t;
+
+struct _xample_spi_t {
+    int              fd;        // spidev, < 0 for mock
+    size_t           batch;     // transfers per buffer
+    size_t           nbuf;
+    spi_buf_t*       buf;
+    xample_pace_t    pace;      // engine schedule, engine thread only
+    xample_pace_t    snap;      // pacing stats published per batch
+    pthread_t        thread;
+    pthread_mutex_t  lock;
+    pthread_cond_t   not_empty;
+    pthread_cond_t   not_full;
+    size_t           head;      // next buffer to decode
+    size_t           count;     // filled buffers
+    size_t           rpos;      // next transfer in head buffer
+    int              running;
+    unsigned long    batches;
+    unsigned long    stalls;    // engine waited on the consumer
+    unsigned long    errors;
+    uint32_t         mock_count[2];
+    int64_t          mock_end;  // end of last mock message (ns)
+};
+
+static int mock_message(xample_spi_t* sp, struct spi_ioc_transfer* tr,
+			unsigned n)
+{
+    struct timespec now;
+    int64_t t;
+    double ns = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+	uint8_t* tx = (uint8_t*)(uintptr_t) tr[i].tx_buf;
+	uint8_t* rx = (uint8_t*)(uintptr_t) tr[i].rx_buf;
+	unsigned ch = (tx[1] >> 6) & 1;  // ODD/SIGN bit, channel 0 or 1
+	uint16_t v = (sp->mock_count[ch]++ * (ch+1)) & 0xfff;
+	rx[0] = 0;
+	rx[1] = v >> 8;
+	rx[2] = v & 0xff;
+	ns += tr[i].len*8*1e9/tr[i].speed_hz + tr[i].delay_usecs*1000.0;
+    }
+    // messages are back to back on the bus, wait for an absolute end
+    // time so wakeup latency does not add up, the tail is spun
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t = (int64_t) now.tv_sec*1000000000 + now.tv_nsec;
+    if (sp->mock_end < t)
+	sp->mock_end = t;
+    sp->mock_end += (int64_t) ns;
+    t = sp->mock_end - MOCK_SPIN_NS;
+    now.tv_sec  = t / 1000000000;
+    now.tv_nsec = t % 1000000000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &now, NULL) == EINTR)
+	;
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	t = (int64_t) now.tv_sec*1000000000 + now.tv_nsec;
+    } while(t < sp->mock_end);
+    return n;
+}
+
+static int spi_message(xample_spi_t* sp, struct spi_ioc_transfer* tr,
+		       unsigned n)
+{
+    if (sp->fd < 0)
+	return mock_message(sp, tr, n);
+    return ioctl(sp->fd, SPI_IOC_MESSAGE(n), tr);
+}
+
+// add the lateness stats of p to acc
+static void pace_merge(xample_pace_t* acc, xample_pace_t* p)
+{
+    acc->n    += p->n;
+    acc->sum  += p->sum;
+    acc->sum2 += p->sum2;
+    if (p->min < acc->min) acc->min = p->min;
+    if (p->max > acc->max) acc->max = p->max;
+    acc->resync = p->resync;
+}
+
+static void* spi_main(void* arg)
+{
+    xample_spi_t* sp = arg;
+    size_t fill = 0;
+
+    while(1) {
+	spi_buf_t* b;
+	size_t off, m;
+
+	pthread_mutex_lock(&sp->lock);
+	while(sp->running && (sp->count == sp->nbuf)) {
+	    sp->stalls++;
+	    pthread_cond_wait(&sp->not_full, &sp->lock);
+	}
+	if (!sp->running) {
+	    pthread_mutex_unlock(&sp->lock);
+	    break;
+	}
+	pthread_mutex_unlock(&sp->lock);
+
+	b = &sp->buf[fill];
+	for (off = 0; off < sp->batch; off += m) {
+	    uint64_t t0;
+	    int r;
+
+	    m = sp->batch - off;
+	    if (m > SPI_MAX_MSG)
+		m = SPI_MAX_MSG;
+	    t0 = xample_pace_clock();
+	    r = spi_message(sp, b->tr + off, m);
+	    if (sp->pace.stat)
+		xample_stat_read(sp->pace.stat, xample_pace_clock() - t0);
+	    if (r < 0) {
+		if (sp->errors++ == 0)
+		    perror("spi message");
+		memset(b->rx + off*SPI_XFER, 0, m*SPI_XFER);
+	    }
+	    xample_pace_wait(&sp->pace, m);
+	}
+	fill = (fill + 1) % sp->nbuf;
+
+	pthread_mutex_lock(&sp->lock);
+	sp->count++;
+	sp->batches++;
+	pace_merge(&sp->snap, &sp->pace);
+	pthread_cond_signal(&sp->not_empty);
+	pthread_mutex_unlock(&sp->lock);
+	xample_pace_reset_stat(&sp->pace);
+    }
+    return NULL;
+}
+
+xample_spi_t* xample_spi_start(int fd, uint32_t speed, int* selector,
+			       size_t nchan, size_t batch, size_t nbuf,
+			       xample_pace_t* pace)
+{
+    xample_spi_t* sp;
+    double d;
+    uint16_t delay1;
+    size_t i, j, m;
+
+    if ((sp = calloc(1, sizeof(xample_spi_t))) == NULL)
+	return NULL;
+    sp->fd    = fd;
+    sp->batch = ((batch + nchan - 1) / nchan)*nchan;  // whole time steps
+    sp->nbuf  = (nbuf < 2) ? 2 : nbuf;
+    sp->pace  = *pace;  // the engine wait on its own copy
+    sp->snap  = *pace;
+    // delay between transfers is short by the 24 bit transfer time and
+    // a share of SPI_SLACK_US, the message then end early and the next
+    // is started on its deadline even with some wakeup latency
+    m = (sp->batch < SPI_MAX_MSG) ? sp->batch : SPI_MAX_MSG;
+    d = pace->period/1000.0 - SPI_XFER*8*1e6/speed - (double) SPI_SLACK_US/m;
+    if (d > pace->period/1000.0 - SPI_XFER*8*1e6/speed - 1)
+	d = pace->period/1000.0 - SPI_XFER*8*1e6/speed - 1;
+    delay1 = (d < 0) ? 0 : ((d > 65535) ? 65535 : d);
+    if ((sp->buf = calloc(sp->nbuf, sizeof(spi_buf_t))) == NULL)
+	goto error;
+    for (i = 0; i < sp->nbuf; i++) {
+	spi_buf_t* b = &sp->buf[i];
+	b->tx = calloc(sp->batch, SPI_XFER);
+	b->rx = calloc(sp->batch, SPI_XFER);
+	b->tr = calloc(sp->batch, sizeof(struct spi_ioc_transfer));
+	if ((b->tx == NULL) || (b->rx == NULL) || (b->tr == NULL))
+	    goto error;
+	for (j = 0; j < sp->batch; j++) {
+	    uint8_t* tx = b->tx + j*SPI_XFER;
+	    tx[0] = 1;
+	    tx[1] = (2+selector[j % nchan]) << 6;
+	    tx[2] = 0;
+	    b->tr[j].tx_buf = (unsigned long) tx;
+	    b->tr[j].rx_buf = (unsigned long) (b->rx + j*SPI_XFER);
+	    b->tr[j].len = SPI_XFER;
+	    b->tr[j].delay_usecs = delay1;
+	    b->tr[j].speed_hz = speed;
+	    b->tr[j].bits_per_word = 8;
+	    b->tr[j].cs_change = 1;
+	}
+    }
+    pthread_mutex_init(&sp->lock, NULL);
+    pthread_cond_init(&sp->not_empty, NULL);
+    pthread_cond_init(&sp->not_full, NULL);
+    sp->running = 1;
+    if (pthread_create(&sp->thread, NULL, spi_main, sp) != 0) {
+	perror("pthread_create");
+	pthread_cond_destroy(&sp->not_full);
+	pthread_cond_destroy(&sp->not_empty);
+	pthread_mutex_destroy(&sp->lock);
+	goto error;
+    }
+    return sp;
+error:
+    sp->running = 0;
+    if (sp->buf != NULL) {
+	for (i = 0; i < sp->nbuf; i++) {
+	    free(sp->buf[i].tx);
+	    free(sp->buf[i].rx);
+	    free(sp->buf[i].tr);
+	}
+	free(sp->buf);
+    }
+    free(sp);
+    return NULL;
+}
+
+size_t xample_spi_read(xample_spi_t* sp, sample_t* samples, size_t n)
+{
+    size_t k = 0;
+
+    while(k < n) {
+	spi_buf_t* b;
+	size_t m;
+
+	pthread_mutex_lock(&sp->lock);
+	while(sp->count == 0)
+	    pthread_cond_wait(&sp->not_empty, &sp->lock);
+	pthread_mutex_unlock(&sp->lock);
+
+	b = &sp->buf[sp->head];
+	m = sp->batch - sp->rpos;
+	if (m > n - k)
+	    m = n - k;
+	xample_mcp3202_decode(b->rx + sp->rpos*SPI_XFER, m, samples + k);
+	k += m;
+	sp->rpos += m;
+	if (sp->rpos == sp->batch) {  // give the buffer back
+	    sp->rpos = 0;
+	    sp->head = (sp->head + 1) % sp->nbuf;
+	    pthread_mutex_lock(&sp->lock);
+	    sp->count--;
+	    pthread_cond_signal(&sp->not_full);
+	    pthread_mutex_unlock(&sp->lock);
+	}
+    }
+    return k;
+}
+
+void xample_spi_stat(xample_spi_t* sp, unsigned long* batches,
+		     unsigned long* stalls, unsigned long* errors)
+{
+    pthread_mutex_lock(&sp->lock);
+    *batches = sp->batches;
+    *stalls  = sp->stalls;
+    *errors  = sp->errors;
+    pthread_mutex_unlock(&sp->lock);
+}
+
+void xample_spi_pace(xample_spi_t* sp, xample_pace_t* p, int reset)
+{
+    pthread_mutex_lock(&sp->lock);
+    *p = sp->snap;
+    if (reset)
+	xample_pace_reset_stat(&sp->snap);
+    pthread_mutex_unlock(&sp->lock);
+}
+
+void xample_spi_stop(xample_spi_t* sp)
+{
+    size_t i;
+
+    pthread_mutex_lock(&sp->lock);
+    sp->running = 0;
+    pthread_cond_broadcast(&sp->not_full);
+    pthread_mutex_unlock(&sp->lock);
+    pthread_join(sp->thread, NULL);
+    pthread_cond_destroy(&sp->not_full);
+    pthread_cond_destroy(&sp->not_empty);
+    pthread_mutex_destroy(&sp->lock);
+    for (i = 0; i < sp->nbuf; i++) {
+	free(sp->buf[i].tx);
+	free(sp->buf[i].rx);
+	free(sp->buf[i].tr);
+    }
+    free(sp->buf);
+    free(sp);
+}
+
+#endif
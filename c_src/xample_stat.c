@@ -0,0 +1,254 @@
+//
+// Show the producer counters of a sample segment
+//
+// usage: xample_stat [-j] [-i <secs>] [-n <count>] <shm-name>
+//
+// Default is a top style report every interval, rates and histogram
+// percentiles over the last interval. With -j each report is one line
+// of JSON with the raw (cumulative) counters and histograms, for
+// monitoring that computes its own rates.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "xample.h"
+
+// last adaptive chunk decision, XAMPLE_CHUNK_xxx
+static const char* chunk_reason[] = {
+    [XAMPLE_CHUNK_FIXED]    = "",
+    [XAMPLE_CHUNK_BEHIND]   = " (behind)",
+    [XAMPLE_CHUNK_OVERHEAD] = " (overhead)",
+    [XAMPLE_CHUNK_LATENCY]  = " (latency)",
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// counters are single words, a copy is consistent per counter
+static void stat_copy(xample_t* xp, xample_stat_t* st)
+{
+    memcpy(st, (void*) &xp->stat, sizeof(xample_stat_t));
+}
+
+// upper bound (ns or samples) of the bucket holding fraction q of the
+// counts in h1 - h0
+static uint64_t hist_quantile(volatile uint64_t* h1, volatile uint64_t* h0,
+			      double q)
+{
+    uint64_t total = 0, sum = 0;
+    int k;
+
+    for (k = 0; k < XAMPLE_STAT_BUCKETS; k++)
+	total += h1[k] - h0[k];
+    if (total == 0)
+	return 0;
+    for (k = 0; k < XAMPLE_STAT_BUCKETS; k++) {
+	sum += h1[k] - h0[k];
+	if (sum >= q*total)
+	    break;
+    }
+    return (k == 0) ? 0 : ((uint64_t) 1 << k) - 1;
+}
+
+static void json_hist(char* name, volatile uint64_t* h)
+{
+    int k, n;
+
+    // trailing empty buckets are left out
+    for (n = XAMPLE_STAT_BUCKETS; (n > 0) && (h[n-1] == 0); n--)
+	;
+    printf(",\"%s\":[", name);
+    for (k = 0; k < n; k++)
+	printf("%s%llu", k ? "," : "", (unsigned long long) h[k]);
+    printf("]");
+}
+
+static void print_json(xample_t* xp, xample_stat_t* st)
+{
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    char* sep = "";
+    int i;
+
+    printf("{\"time\":%llu,\"write_seq\":%llu,\"rate\":%.3f,"
+	   "\"channels\":%lu,\"format\":\"%s\",\"ring_samples\":%lu",
+	   (unsigned long long) clock_ns(CLOCK_REALTIME),
+	   (unsigned long long) xample_seq(xp),
+	   (xp->rate >> 8) + (xp->rate & 0xff)/256.0, xp->channels,
+	   xample_format_name(xp->format), xp->ring_samples);
+#define JSON_U64(f) \
+    printf(",\"" #f "\":%llu", (unsigned long long) st->f)
+    JSON_U64(start_ns);
+    JSON_U64(samples);
+    JSON_U64(rate_mhz);
+    JSON_U64(reads);
+    JSON_U64(read_ns);
+    JSON_U64(read_max_ns);
+    JSON_U64(paced);
+    JSON_U64(late_ns);
+    JSON_U64(late_max_ns);
+    JSON_U64(resyncs);
+    JSON_U64(blocked_ns);
+    JSON_U64(chunks);
+    JSON_U64(chunk);
+    JSON_U64(chunk_grow);
+    JSON_U64(chunk_shrink);
+    JSON_U64(chunk_reason);
+    JSON_U64(overruns);
+    JSON_U64(lost);
+#undef JSON_U64
+    json_hist("read_hist", st->read_hist);
+    json_hist("late_hist", st->late_hist);
+    json_hist("chunk_hist", st->chunk_hist);
+    printf(",\"reader_lag\":%llu,\"blocked\":%u,\"readers\":[",
+	   (unsigned long long) xp->reader_lag, xp->blocked);
+    for (i = 0; i < XAMPLE_MAX_READERS; i++) {
+	xample_reader_t* rp = &xp->readers[i];
+	uint32_t pid = rp->pid;
+	uint64_t beat = rp->heartbeat;
+	if (pid == 0)
+	    continue;
+	printf("%s{\"slot\":%d,\"pid\":%u,\"flags\":%u,\"read_seq\":%llu,"
+	       "\"heartbeat_age_ns\":%llu}", sep, i, pid,
+	       rp->flags, (unsigned long long) rp->read_seq,
+	       (unsigned long long) ((now > beat) ? now - beat : 0));
+	sep = ",";
+    }
+    printf("]}\n");
+}
+
+static void print_top(xample_t* xp, xample_stat_t* st, xample_stat_t* st0,
+		      double dt)
+{
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    uint64_t seq = xample_seq(xp);
+    uint64_t reads = st->reads - st0->reads;
+    uint64_t paced = st->paced - st0->paced;
+    uint64_t chunks = st->chunks - st0->chunks;
+    double rate = (xp->rate >> 8) + (xp->rate & 0xff)/256.0;
+    int i;
+
+    printf("\033[H\033[J");  // home, clear
+    printf("rate %.3f Hz x %lu, format %s, ring %lu samples (%.2f s)\n",
+	   rate, xp->channels, xample_format_name(xp->format),
+	   xp->ring_samples, xp->ring_samples/(rate*xp->channels));
+    printf("samples  %llu, achieved %.3f Hz, %.1f samples/s\n",
+	   (unsigned long long) st->samples, st->rate_mhz/1000.0,
+	   (st->samples - st0->samples)/dt);
+    printf("reads    %.1f/s, avg %.1f us, p50 < %.1f us, p99 < %.1f us, "
+	   "max %.1f us\n", reads/dt,
+	   reads ? (st->read_ns - st0->read_ns)/1000.0/reads : 0.0,
+	   hist_quantile(st->read_hist, st0->read_hist, 0.5)/1000.0,
+	   hist_quantile(st->read_hist, st0->read_hist, 0.99)/1000.0,
+	   st->read_max_ns/1000.0);
+    printf("pacing   %.1f/s, late avg %.1f us, p99 < %.1f us, "
+	   "max %.1f us, resync %llu\n", paced/dt,
+	   paced ? (st->late_ns - st0->late_ns)/1000.0/paced : 0.0,
+	   hist_quantile(st->late_hist, st0->late_hist, 0.99)/1000.0,
+	   st->late_max_ns/1000.0, (unsigned long long) st->resyncs);
+    printf("chunks   %.1f/s, size %llu, avg %.1f, p50 <= %llu, "
+	   "grow %llu, shrink %llu%s\n",
+	   chunks/dt, (unsigned long long) st->chunk,
+	   chunks ? (double)(st->samples - st0->samples)/chunks : 0.0,
+	   (unsigned long long)
+	   hist_quantile(st->chunk_hist, st0->chunk_hist, 0.5),
+	   (unsigned long long) st->chunk_grow,
+	   (unsigned long long) st->chunk_shrink,
+	   chunk_reason[(st->chunk_reason < 4) ? st->chunk_reason : 0]);
+    printf("blocked  %.1f ms/s%s, overruns %llu (%llu samples lost)\n",
+	   (st->blocked_ns - st0->blocked_ns)/1e6/dt,
+	   xp->blocked ? " (now)" : "",
+	   (unsigned long long) st->overruns, (unsigned long long) st->lost);
+    printf("\n%4s %8s %5s %12s %10s\n", "slot", "pid", "flags", "lag",
+	   "heartbeat");
+    for (i = 0; i < XAMPLE_MAX_READERS; i++) {
+	xample_reader_t* rp = &xp->readers[i];
+	uint32_t pid = rp->pid;
+	uint64_t rseq = rp->read_seq;
+	uint64_t beat = rp->heartbeat;
+	if (pid == 0)
+	    continue;
+	printf("%4d %8u %5s %12llu %8.1f s\n", i, pid,
+	       (rp->flags & XAMPLE_READER_CRITICAL) ? "crit" : "-",
+	       (unsigned long long) ((seq > rseq) ? seq - rseq : 0),
+	       (now > beat) ? (now - beat)/1e9 : 0.0);
+    }
+    fflush(stdout);
+}
+
+void usage(char* prog)
+{
+    printf("usage: %s [options] <shm-name>\n", prog);
+    printf("  [-j]          one line of json per report\n"
+	   "  [-i <secs>]   report interval (default 1)\n"
+	   "  [-n <count>]  number of reports (default 0 = no limit)\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    xample_t* xp;
+    sample_t* data;
+    xample_stat_t st, st0;
+    double interval = 1.0;
+    uint64_t t0, t1;
+    long count = 0;
+    int json = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ji:n:")) != -1) {
+	switch(opt) {
+	case 'j':
+	    json = 1;
+	    break;
+	case 'i':
+	    if ((interval = atof(optarg)) <= 0)
+		usage(argv[0]);
+	    break;
+	case 'n':
+	    count = atol(optarg);
+	    break;
+	default: /* '?' */
+	    usage(argv[0]);
+	}
+    }
+    if (optind >= argc)
+	usage(argv[0]);
+
+    if ((xp = xample_open(argv[optind], 0, &data)) == NULL) {
+	fprintf(stderr, "xample_stat: unable to open shm %s\n", argv[optind]);
+	exit(1);
+    }
+
+    stat_copy(xp, &st0);
+    t0 = clock_ns(CLOCK_MONOTONIC);
+    while(1) {
+	if (json) {
+	    stat_copy(xp, &st);
+	    print_json(xp, &st);
+	    fflush(stdout);
+	}
+	else {
+	    // rates over the interval
+	    usleep((useconds_t) (interval*1e6));
+	    t1 = clock_ns(CLOCK_MONOTONIC);
+	    stat_copy(xp, &st);
+	    print_top(xp, &st, &st0, (t1 - t0)/1e9);
+	    st0 = st;
+	    t0 = t1;
+	}
+	if ((count > 0) && (--count == 0))
+	    break;
+	if (json)
+	    usleep((useconds_t) (interval*1e6));
+    }
+    xample_close(xp);
+    return 0;
+}
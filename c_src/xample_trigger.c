@@ -0,0 +1,258 @@
+//
+// Trigger scan kernels
+//
+// Find the first sample in a vector where a trigger condition fires.
+// All conditions are turned into unsigned saturated subtractions so
+// the kernels have no per sample branches:
+//
+//   v > u          <=>  (v -sat u) != 0
+//   v <= l         <=>  ((l+1) -sat v) != 0
+//   v-v' > p       <=>  ((v -sat v') -sat p) != 0
+//   v'-v > n       <=>  ((v' -sat v) -sat n) != 0
+//   |v-v'| > d     <=>  ((v -sat v') -sat d) | ((v' -sat v) -sat d) != 0
+//
+// A disabled condition get a threshold that never fires.
+//
+// Interleaved channels are scanned in the same pass, each lane use the
+// thresholds of its channel and the previous sample is the one nchan
+// samples back.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRIGGER_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*scan_fn_t)(trigger_scan_t* ts, const sample_t* vec,
+			    size_t n, const sample_t* prev, size_t o);
+
+static inline uint16_t subs16(uint16_t a, uint16_t b)
+{
+    return (a > b) ? a - b : 0;
+}
+
+static inline uint16_t clamp16(unsigned long v)
+{
+    return (v > 0xffff) ? 0xffff : v;
+}
+
+void xample_trigger_merge(trigger_t* acc, trigger_t* t)
+{
+    unsigned char m = acc->mask;
+
+    if (t->mask & UPPER_LIMIT_EXCEEDED)
+	acc->upper_limit = ((m & UPPER_LIMIT_EXCEEDED) &&
+			    (acc->upper_limit < t->upper_limit)) ?
+	    acc->upper_limit : t->upper_limit;
+    if (t->mask & BELOW_LOWER_LIMIT)
+	acc->lower_limit = ((m & BELOW_LOWER_LIMIT) &&
+			    (acc->lower_limit > t->lower_limit)) ?
+	    acc->lower_limit : t->lower_limit;
+    if (t->mask & CHANGED_BY_MORE_THAN_DELTA)
+	acc->delta = ((m & CHANGED_BY_MORE_THAN_DELTA) &&
+		      (acc->delta < t->delta)) ? acc->delta : t->delta;
+    if (t->mask & CHANGED_BY_MORE_THAN_NEGATIVE_DELTA)
+	acc->negative_delta = ((m & CHANGED_BY_MORE_THAN_NEGATIVE_DELTA) &&
+			       (acc->negative_delta < t->negative_delta)) ?
+	    acc->negative_delta : t->negative_delta;
+    if (t->mask & CHANGED_BY_MORE_THAN_POSITIVE_DELTA)
+	acc->positive_delta = ((m & CHANGED_BY_MORE_THAN_POSITIVE_DELTA) &&
+			       (acc->positive_delta < t->positive_delta)) ?
+	    acc->positive_delta : t->positive_delta;
+    acc->mask |= t->mask;
+}
+
+int xample_trigger_compile(trigger_scan_t* ts, trigger_t* t,
+			   unsigned char* m0, size_t nchan)
+{
+    size_t period, j;
+
+    if ((nchan < 1) || (nchan > XAMPLE_MAX_CHANNELS))
+	return -1;
+    for (period = 16; (period % nchan) != 0; period += 16)
+	;
+    ts->nchan  = nchan;
+    ts->period = period;
+    ts->always = 0;
+    // lane j in the arrays is channel j % nchan
+    for (j = 0; j < 2*period; j++) {
+	size_t ch = j % nchan;
+	trigger_t* tc = &t[ch];
+	unsigned char mask = tc->mask & ~(m0[ch] & LIMIT_BITS);
+
+	ts->upper[j] = (mask & UPPER_LIMIT_EXCEEDED) ?
+	    clamp16(tc->upper_limit) : 0xffff;
+	ts->lower1[j] = 0;
+	if (mask & BELOW_LOWER_LIMIT) {
+	    if (tc->lower_limit >= 0xffff)
+		ts->always |= (1 << ch);
+	    else
+		ts->lower1[j] = tc->lower_limit + 1;
+	}
+	ts->delta[j]  = (mask & CHANGED_BY_MORE_THAN_DELTA) ?
+	    clamp16(tc->delta) : 0xffff;
+	ts->negative_delta[j] = (mask & CHANGED_BY_MORE_THAN_NEGATIVE_DELTA) ?
+	    clamp16(tc->negative_delta) : 0xffff;
+	ts->positive_delta[j] = (mask & CHANGED_BY_MORE_THAN_POSITIVE_DELTA) ?
+	    clamp16(tc->positive_delta) : 0xffff;
+    }
+    return 0;
+}
+
+static inline int scan_one(trigger_scan_t* ts, size_t j,
+			   sample_t v, sample_t prev)
+{
+    uint16_t dp = subs16(v, prev);
+    uint16_t dn = subs16(prev, v);
+    return (subs16(v, ts->upper[j]) | subs16(ts->lower1[j], v) |
+	    subs16(dp, ts->delta[j]) | subs16(dn, ts->delta[j]) |
+	    subs16(dp, ts->positive_delta[j]) |
+	    subs16(dn, ts->negative_delta[j])) != 0;
+}
+
+// prev[0..nchan) are the samples before vec, lane of vec[0] is o
+static size_t scan_scalar(trigger_scan_t* ts, const sample_t* vec,
+			  size_t n, const sample_t* prev, size_t o)
+{
+    size_t nchan = ts->nchan;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+	sample_t v0 = (i < nchan) ? prev[i] : vec[i-nchan];
+	if (scan_one(ts, o, vec[i], v0))
+	    return i;
+	if (++o == ts->period)
+	    o = 0;
+    }
+    return n;
+}
+
+#if defined(TRIGGER_X86)
+
+static size_t scan_sse2(trigger_scan_t* ts, const sample_t* vec,
+			size_t n, const sample_t* prev, size_t o)
+{
+    const __m128i zero  = _mm_setzero_si128();
+    size_t nchan = ts->nchan;
+    size_t i, j;
+
+    if ((i = scan_scalar(ts, vec, (n < nchan) ? n : nchan, prev, o)) < nchan)
+	return i;
+    // vec[i-nchan] is the previous sample on the same channel
+    j = (o + i) % ts->period;
+    for (; i + 8 <= n; i += 8) {
+	__m128i v  = _mm_loadu_si128((const __m128i*) (vec+i));
+	__m128i v1 = _mm_loadu_si128((const __m128i*) (vec+i-nchan));
+	__m128i dp = _mm_subs_epu16(v, v1);
+	__m128i dn = _mm_subs_epu16(v1, v);
+	__m128i r;
+#define LANES(a) _mm_loadu_si128((const __m128i*) (ts->a+j))
+	r = _mm_or_si128(_mm_subs_epu16(v, LANES(upper)),
+			 _mm_subs_epu16(LANES(lower1), v));
+	r = _mm_or_si128(r, _mm_subs_epu16(_mm_or_si128(dp, dn),
+					   LANES(delta)));
+	r = _mm_or_si128(r, _mm_subs_epu16(dp, LANES(positive_delta)));
+	r = _mm_or_si128(r, _mm_subs_epu16(dn, LANES(negative_delta)));
+#undef LANES
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(r, zero)) != 0xffff)
+	    break;
+	if ((j += 8) >= ts->period)
+	    j -= ts->period;
+    }
+    return i + scan_scalar(ts, vec+i, n-i, vec+i-nchan, j);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(trigger_scan_t* ts, const sample_t* vec,
+			size_t n, const sample_t* prev, size_t o)
+{
+    const __m256i zero  = _mm256_setzero_si256();
+    size_t nchan = ts->nchan;
+    size_t i, j;
+
+    if ((i = scan_scalar(ts, vec, (n < nchan) ? n : nchan, prev, o)) < nchan)
+	return i;
+    j = (o + i) % ts->period;
+    for (; i + 16 <= n; i += 16) {
+	__m256i v  = _mm256_loadu_si256((const __m256i*) (vec+i));
+	__m256i v1 = _mm256_loadu_si256((const __m256i*) (vec+i-nchan));
+	__m256i dp = _mm256_subs_epu16(v, v1);
+	__m256i dn = _mm256_subs_epu16(v1, v);
+	__m256i r;
+#define LANES(a) _mm256_loadu_si256((const __m256i*) (ts->a+j))
+	r = _mm256_or_si256(_mm256_subs_epu16(v, LANES(upper)),
+			    _mm256_subs_epu16(LANES(lower1), v));
+	r = _mm256_or_si256(r, _mm256_subs_epu16(_mm256_or_si256(dp, dn),
+						 LANES(delta)));
+	r = _mm256_or_si256(r, _mm256_subs_epu16(dp, LANES(positive_delta)));
+	r = _mm256_or_si256(r, _mm256_subs_epu16(dn, LANES(negative_delta)));
+#undef LANES
+	if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(r, zero)) !=
+	    0xffffffff)
+	    break;
+	if ((j += 16) >= ts->period)
+	    j -= ts->period;
+    }
+    return i + scan_scalar(ts, vec+i, n-i, vec+i-nchan, j);
+}
+
+#endif
+
+static scan_fn_t scan_fn = NULL;
+
+int xample_trigger_kernel(char* name)
+{
+    if ((name == NULL) || (strcmp(name, "auto") == 0)) {
+#if defined(TRIGGER_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	    scan_fn = scan_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+	    scan_fn = scan_sse2;
+	else
+#endif
+	    scan_fn = scan_scalar;
+	return 0;
+    }
+    if (strcmp(name, "scalar") == 0) {
+	scan_fn = scan_scalar;
+	return 0;
+    }
+#if defined(TRIGGER_X86)
+    __builtin_cpu_init();
+    if ((strcmp(name, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+	scan_fn = scan_sse2;
+	return 0;
+    }
+    if ((strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+	scan_fn = scan_avx2;
+	return 0;
+    }
+#endif
+    return -1;
+}
+
+size_t xample_trigger_scan(trigger_scan_t* ts, const sample_t* vec,
+			   size_t n, const sample_t* prev, size_t chan0)
+{
+    size_t i;
+
+    if (scan_fn == NULL)
+	xample_trigger_kernel(NULL);
+    if (ts->always) {
+	// first sample from a channel that always fire
+	for (i = 0; (i < n) && (i < ts->nchan); i++) {
+	    if (ts->always & (1 << ((chan0 + i) % ts->nchan)))
+		break;
+	}
+	if (i < n)
+	    n = i;
+    }
+    return scan_fn(ts, vec, n, prev, chan0);
+}
@@ -0,0 +1,160 @@
+//
+// Decode xample logger .xmc files into wav
+//
+// usage: xample_decode [-s <sample>] [-n <num>] <file.xmc> <file.wav>
+//
+// -s and -n count samples of all channels (as the logger -n option),
+// seeking skip whole blocks by their headers without decoding them.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../c_src/xample.h"
+
+static void write_uint16(uint16_t value, FILE* f)
+{
+    value = htole16(value);
+    fwrite(&value, 1, sizeof(value), f);
+}
+
+static void write_uint32(uint32_t value, FILE* f)
+{
+    value = htole32(value);
+    fwrite(&value, 1, sizeof(value), f);
+}
+
+static void write_wav_header(FILE* f, size_t nchan, uint32_t rate,
+			     size_t nsamples)
+{
+    uint32_t size = nsamples*2;
+
+    fwrite("RIFF", 1, 4, f);
+    write_uint32(36 + size, f);
+    fwrite("WAVE", 1, 4, f);
+    fwrite("fmt ", 1, 4, f);
+    write_uint32(16, f);
+    write_uint16(1, f);
+    write_uint16(nchan, f);
+    write_uint32(rate >> 8, f);
+    write_uint32((rate >> 8)*nchan*2, f);
+    write_uint16(nchan*2, f);
+    write_uint16(16, f);
+    fwrite("data", 1, 4, f);
+    write_uint32(size, f);
+}
+
+void usage(char* prog)
+{
+    printf("usage: %s [options] <file.xmc> <file.wav>\n", prog);
+    printf("  [-s <num>]   first sample to decode (default 0)\n"
+	   "  [-n <num>]   number of samples to decode (default all)\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t first = 0;
+    uint64_t count = (uint64_t) -1;
+    uint64_t written = 0;
+    size_t nchan, block_steps, pos;
+    uint32_t rate;
+    struct stat st;
+    uint8_t* buf;
+    sample_t* out;
+    FILE* f;
+    int fd, opt, r;
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+	switch(opt) {
+	case 's':
+	    first = strtoull(optarg, NULL, 0);
+	    break;
+	case 'n':
+	    count = strtoull(optarg, NULL, 0);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind+2 != argc)
+	usage(argv[0]);
+
+    if ((fd = open(argv[optind], O_RDONLY)) < 0) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+	fprintf(stderr, "%s: empty file\n", argv[optind]);
+	exit(1);
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    if ((r = xample_dec_header(buf, st.st_size, &nchan, &rate,
+			       &block_steps)) < 0) {
+	fprintf(stderr, "%s: not an xample codec file\n", argv[optind]);
+	exit(1);
+    }
+    pos = r;
+    first -= (first % nchan);  // start on channel 0
+    if ((out = malloc(block_steps*nchan*sizeof(sample_t))) == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    if ((f = fopen(argv[optind+1], "w")) == NULL) {
+	perror(argv[optind+1]);
+	exit(1);
+    }
+    write_wav_header(f, nchan, rate, 0);
+
+    while((pos < st.st_size) && (written < count)) {
+	uint64_t bfirst;
+	size_t steps, i0, n;
+	ssize_t size, m;
+
+	if ((size = xample_dec_block_info(buf+pos, st.st_size-pos,
+					  &bfirst, &steps)) < 0) {
+	    fprintf(stderr, "bad block at offset %zu\n", pos);
+	    break;
+	}
+	if (bfirst + steps*nchan <= first) {  // seek
+	    pos += size;
+	    continue;
+	}
+	if ((m = xample_dec_block(buf+pos, size, nchan, block_steps, out)) < 0) {
+	    fprintf(stderr, "decode error at offset %zu\n", pos);
+	    break;
+	}
+	i0 = (first > bfirst) ? first - bfirst : 0;
+	n = m - i0;
+	if (n > count - written)
+	    n = count - written;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	fwrite(out + i0, sizeof(sample_t), n, f);
+#else
+	{
+	    size_t i;
+	    for (i = 0; i < n; i++)
+		write_uint16(out[i0+i], f);
+	}
+#endif
+	written += n;
+	pos += size;
+    }
+    // patch sizes
+    rewind(f);
+    write_wav_header(f, nchan, rate, written);
+    fclose(f);
+    printf("%s: %llu samples, %zu channels, %u Hz\n", argv[optind+1],
+	   (unsigned long long) written, nchan, rate >> 8);
+    exit(0);
+}
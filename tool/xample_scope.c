@@ -115,14 +115,21 @@ void update_data(state_t* sp)
 			 GRID_WIDTH, GRID_HEIGHT, 0);
 }
 
-void draw_samples(state_t* sp, xample_t* xp, unsigned long frame,
-		  sample_t* sample_buffer)
+// draw the frame starting at sample seq, return -1 if the producer
+// overwrote it while it was copied, nothing is drawn then
+int draw_samples(state_t* sp, xample_t* xp, uint64_t seq,
+		 sample_t* sample_buffer)
 {
     unsigned long samples_per_frame = xp->samples_per_frame;
-    int frame_offset = frame * samples_per_frame;
+    sample_t vec[samples_per_frame];
     int x = GRID_LEFT;
     int i = 0;
 
+    xample_unpack(xp->format, sample_buffer, xample_offset(xp, seq),
+		  samples_per_frame, vec);
+    if (xample_check(xp, seq, samples_per_frame) > 0)
+	return -1;
+
     // start with redraw a clean grid
     epx_pixmap_copy_area(sp->grid, sp->px, 
 			 0, 0, GRID_LEFT, GRID_TOP,
@@ -132,7 +139,7 @@ void draw_samples(state_t* sp, xample_t* xp, unsigned long frame,
     while((i < samples_per_frame) && (i < GRID_WIDTH)) {
 	int k;
 	for (k = 0; k < xp->channels; k++) {
-	    int ys = (65535-sample_buffer[frame_offset+i]);
+	    int ys = (65535-vec[i]);
 	    int y;
 	    y = GRID_TOP + ((ys*GRID_HEIGHT) >> 16);
 	    epx_pixmap_put_pixel(sp->px, x, y, 0, epx_pixel_black);
@@ -142,7 +149,7 @@ void draw_samples(state_t* sp, xample_t* xp, unsigned long frame,
     }
 
     update_window(sp);
-    
+    return 0;
 }
 
 
@@ -151,7 +158,9 @@ int main(int argc, char** argv)
     state_t s;
     xample_t* xp;
     sample_t* sample_buffer;
-    unsigned long frame;
+    uint64_t seq;
+    uint64_t drawn = 0;
+    unsigned long overruns = 0;
     
     memset(&s, 0, sizeof(s));
 
@@ -160,7 +169,7 @@ int main(int argc, char** argv)
 	exit(1);
     }
 
-    if ((xp = xample_open(argv[1], &sample_buffer)) == NULL) {
+    if ((xp = xample_open(argv[1], 0, &sample_buffer)) == NULL) {
 	fprintf(stderr, "xample_scope: unable to open shm %s\n", argv[1]);
 	exit(1);
     }
@@ -171,16 +180,20 @@ int main(int argc, char** argv)
 
     update_window(&s);
 
-    frame = xp->current_frame;
+    seq = xample_seq(xp);
 
     while(1) {
 	epx_event_t e;
 
-	if (frame != xp->current_frame) {
-	    unsigned next_frame = xp->current_frame;
-	    // draw data in current_page
-	    draw_samples(&s, xp, frame, sample_buffer);
-	    frame = next_frame;
+	if ((seq >= xp->samples_per_frame) && (seq != drawn)) {
+	    // draw the last complete frame
+	    if (draw_samples(&s, xp, seq - xp->samples_per_frame,
+			     sample_buffer) < 0) {
+		overruns++;
+		fprintf(stderr, "xample_scope: frame overwritten while "
+			"drawn (%lu overruns)\n", overruns);
+	    }
+	    drawn = seq;
 	}
 
 	if (epx_backend_event_read(s.be, &e) > 0) {
@@ -198,6 +211,8 @@ int main(int argc, char** argv)
 		exit(0);
 	    }
 	}
-	usleep(50000);
+	// sleep until next frame, but keep polling events
+	xample_wait(xp, seq, 50);
+	seq = xample_seq(xp);
     }
 }